@@ -5,11 +5,32 @@
 #include <vector>
 #include <optional>
 #include <map>
+#include <cstdint>
 
 struct Args {
-    std::string filename;
+    std::vector<std::string> filenames;
     std::string soname;
+    std::string interpreter;
     std::map<std::string, std::string> neededs;
+    bool update_build_id = false;
+    bool digest = false;
+    bool query = false;
+    bool graph = false;
+    unsigned jobs = 0;
+    std::string cache;
+    bool dedup = false;
+    std::string journal;
+    std::string record_plan;
+    std::string replay_plan;
+    std::string index;
+    std::string who_needs;
+    bool verify_versions = false;
+    std::vector<std::string> library_path;
+    bool tar = false;
+    bool zip = false;
+    bool cpio = false;
+    bool oci = false;
+    bool blob = false;
 
     static std::optional<std::pair<std::string, std::string> > parse_needed(const char* n);
 
@@ -21,4 +42,10 @@ struct Args {
 
     bool have_work() const;
 
+    // "-f -": the file comes from stdin and goes to stdout
+    bool stdio() const;
+
+    // Hash of the requested modifications, 0 when there are none
+    uint64_t fingerprint() const;
+
 };
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <ostream>
+
+#include <safe_patchelf/Args.h>
+#include <safe_patchelf/Walker.h>
+#include <safe_patchelf/ScanCache.h>
+#include <safe_patchelf/Summary.h>
+#include <safe_patchelf/Plan.h>
+#include <safe_patchelf/VersionCheck.h>
+
+// Patch mode over all collected files.
+class Batch {
+public:
+    // Byte level edits: offset in file and new bytes
+    using Edits = std::vector<std::pair<size_t, std::string> >;
+
+    // Modified byte ranges: offset and length
+    using Ranges = std::vector<std::pair<size_t, size_t> >;
+
+    struct Outcome {
+        int ret = -1;
+        bool patched = false;                   // false for skipped files
+        Edits edits;
+        std::string sha256;                     // when Args::digest
+        std::optional<ElfSummary> summary;      // when a cache or journal is used
+    };
+
+    static int run(const Args& args);
+
+    // Patches the inode once through the first path of the group, the
+    // result is attributed to all of its paths. Files found in directories
+    // none of the rules apply to are skipped, named ones are errors.
+    // Edits are added to the plan when given, new needed libraries are
+    // checked by versions.
+    static Outcome patch_file(const Walker::Group& links, const Args& args, ScanCache* cache,
+                              const std::string& prefix, std::ostream& out, std::ostream& err, Plan* plan = nullptr,
+                              VersionCheck* versions = nullptr);
+
+    // Same on content in memory, no file system access. The image has to
+    // fit into size bytes with all its tables, segments and sections
+    // (elf_extent()), otherwise nothing is touched. Already matching
+    // content and images none of the rules apply to (archive members) are
+    // left untouched and succeed, unless strict; changed is set when bytes
+    // were written, ranges receives the sorted, merged ranges that were.
+    // No version check, digest, cache or plan, Args::parse_args rejects
+    // those for streams and archives.
+    static int patch_buffer(caddr_t content, size_t size, const Args& args, const std::string& prefix,
+                            std::ostream& out, std::ostream& err, bool* changed = nullptr, Ranges* ranges = nullptr,
+                            bool strict = false);
+
+private:
+    // Groups of identical content (by size, header/.dynamic hash, full
+    // hash, then confirmed byte by byte), each with at least two members.
+    static std::vector<std::vector<size_t> > identical_contents(const std::vector<Walker::Group>& groups,
+                                                               const std::vector<bool>& candidates, unsigned jobs);
+
+    // Make follower content equal to the patched leader: FICLONE when the
+    // file system supports it, otherwise replay the leader edits. Fails
+    // when the follower changed since it was collected.
+    static int reuse_patch(const Walker::Entry& follower, const Walker::Entry& leader, const Edits& edits, std::ostream& err);
+};
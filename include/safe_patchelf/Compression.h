@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <ostream>
+#include <iostream>
+
+// Stream (de)compression stages of the archive pipeline. Each stage reads
+// one file descriptor to its end and writes another one.
+//
+// gzip output is a sequence of independent members, one per input block,
+// compressed in parallel; xz uses the block parallel liblzma encoder and
+// zstd the multi threaded libzstd one. Block sizes are fixed, so the
+// output does not depend on the number of threads.
+class Compression {
+public:
+    enum Format {
+        None,
+        Gzip,
+        Xz,
+        Zstd,
+    };
+
+    // By magic bytes
+    static Format detect(const char* data, size_t len);
+
+    static const char* name(Format format);
+
+    // Built with support for the format
+    static bool supported(Format format);
+
+    // prefix: bytes already read from in
+    static bool decompress(Format format, const std::string& prefix, int in, int out, std::ostream& err = std::cerr);
+
+    static bool compress(Format format, int in, int out, unsigned jobs, std::ostream& err = std::cerr);
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <ostream>
+#include <iostream>
+
+#include <safe_patchelf/Args.h>
+
+// In place patching of ELF members of uncompressed newc cpio archives
+// (initramfs images). The patch operations never change sizes, so each
+// member is patched over its byte range of the mapped archive and the
+// modified ranges are written back; nothing else is rewritten and no
+// temporary files are used. Members are patched in parallel.
+//
+// Concatenated archives are followed across their trailers. Compressed
+// segments (early microcode images followed by a compressed archive)
+// end the scan and are left alone.
+class Cpio {
+public:
+    struct Stats {
+        size_t members = 0;
+        size_t elf = 0;
+        size_t changed = 0;
+        size_t failed = 0;
+    };
+
+    // Archives given by Args::filenames one after the other
+    static int run(const Args& args);
+
+    // Members failing to patch are kept unchanged and make the result
+    // non zero, malformed archives are left alone with -1.
+    static int patch(const std::string& path, const Args& args, std::ostream& out = std::cout,
+                     std::ostream& err = std::cerr, Stats* stats = nullptr);
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <utility>
+#include <optional>
+#include <algorithm>
+
+#include <cstring>
+
+#include <safe_patchelf/commons.h>
+#include <safe_patchelf/Elf.h>
+
+
+template<ElfClass Class, class Worker, class... WorkerArgs>
+int class_entry(void* content, Endian elf_endian, WorkerArgs&&... worker_args) {
+    bool success = false;
+
+    if (elf_endian == Little) {
+        using LElf = Elf<Class, Little>;
+        LElf elf(content);
+        success = Worker::entry(elf, std::forward<WorkerArgs>(worker_args)...);
+    } else if (elf_endian == Big) {
+        using BElf = Elf<Class, Big>;
+        BElf elf(content);
+        success = Worker::entry(elf, std::forward<WorkerArgs>(worker_args)...);
+    }
+
+    if (!success) {
+        return -1;
+    } else {
+        return 0;
+    }
+}
+
+
+inline std::pair<ElfClass, Endian> elf_class(caddr_t contents) {
+    if (::memcmp(contents, ELFMAG, SELFMAG) != 0)
+        return std::make_pair(None, Unknown);
+
+    if (contents[EI_VERSION] != EV_CURRENT)
+        return std::make_pair(None, Unknown);
+
+    Endian elf_endian = contents[EI_DATA] == ELFDATA2LSB ? Little : Big;
+
+    if (contents[EI_CLASS] == ELFCLASS32)
+        return std::make_pair(Elf32, elf_endian);
+
+    if (contents[EI_CLASS] == ELFCLASS64)
+        return std::make_pair(Elf64, elf_endian);
+
+    return std::make_pair(None, Unknown);
+}
+
+
+// Check that ELF header, program and section header tables and the section
+// names table lie inside of the content. Elf<> itself trusts these.
+template<ElfClass Class>
+bool elf_headers_fit(caddr_t contents, size_t size, Endian elf_endian) {
+    using Traits = ElfClassTraits<Class>;
+
+    if (size < sizeof(typename Traits::Ehdr))
+        return false;
+
+    auto rd = [elf_endian](auto v) {
+        return (elf_endian == GetHostEndian::endian) ? v : Bswap::bswap(v);
+    };
+
+    auto ehdr = reinterpret_cast<typename Traits::Ehdr*>(contents);
+
+    size_t phoff = rd(ehdr->e_phoff);
+    size_t phnum = rd(ehdr->e_phnum);
+    if (phnum && (phoff > size || phnum * sizeof(typename Traits::Phdr) > size - phoff))
+        return false;
+
+    size_t shoff = rd(ehdr->e_shoff);
+    size_t shnum = rd(ehdr->e_shnum);
+    if (shnum && (shoff > size || shnum * sizeof(typename Traits::Shdr) > size - shoff))
+        return false;
+
+    if (shnum) {
+        size_t shstrndx = rd(ehdr->e_shstrndx);
+        if (shstrndx >= shnum)
+            return false;
+
+        auto shstrtab = reinterpret_cast<typename Traits::Shdr*>(contents + shoff) + shstrndx;
+        size_t off = rd(shstrtab->sh_offset);
+        size_t len = rd(shstrtab->sh_size);
+        if (off > size || len > size - off || len == 0 || contents[off + len - 1] != '\0')
+            return false;
+
+        auto shdrs = reinterpret_cast<typename Traits::Shdr*>(contents + shoff);
+        for (size_t i = 0; i < shnum; ++i) {
+            if (rd(shdrs[i].sh_name) >= len)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
+inline bool elf_headers_fit(caddr_t contents, size_t size, std::pair<ElfClass, Endian> el_class) {
+    switch (el_class.first) {
+    case Elf32: return elf_headers_fit<Elf32>(contents, size, el_class.second);
+    case Elf64: return elf_headers_fit<Elf64>(contents, size, el_class.second);
+    default:    return false;
+    }
+}
+
+
+// Size of the ELF image at contents: end of the farthest header table,
+// segment or section with file content. Nothing when the header sizes are
+// not the expected ones or any part lies outside of size bytes, so the
+// image can be used as an Elf<> over a sub range of a larger buffer.
+template<ElfClass Class>
+std::optional<size_t> elf_extent(caddr_t contents, size_t size, Endian elf_endian) {
+    using Traits = ElfClassTraits<Class>;
+
+    if (!elf_headers_fit<Class>(contents, size, elf_endian))
+        return std::nullopt;
+
+    auto rd = [elf_endian](auto v) {
+        return (elf_endian == GetHostEndian::endian) ? v : Bswap::bswap(v);
+    };
+
+    auto ehdr = reinterpret_cast<typename Traits::Ehdr*>(contents);
+
+    size_t phnum = rd(ehdr->e_phnum);
+    size_t shnum = rd(ehdr->e_shnum);
+    if (rd(ehdr->e_ehsize) != sizeof(typename Traits::Ehdr)
+        || (phnum && rd(ehdr->e_phentsize) != sizeof(typename Traits::Phdr))
+        || (shnum && rd(ehdr->e_shentsize) != sizeof(typename Traits::Shdr)))
+        return std::nullopt;
+
+    size_t extent = sizeof(typename Traits::Ehdr);
+    bool fits = true;
+    auto add = [&](size_t off, size_t len) {
+        if (off > size || len > size - off)
+            fits = false;
+        else
+            extent = std::max(extent, off + len);
+    };
+
+    if (phnum)
+        add(rd(ehdr->e_phoff), phnum * sizeof(typename Traits::Phdr));
+    if (shnum)
+        add(rd(ehdr->e_shoff), shnum * sizeof(typename Traits::Shdr));
+
+    auto phdrs = reinterpret_cast<typename Traits::Phdr*>(contents + rd(ehdr->e_phoff));
+    for (size_t i = 0; i < phnum && fits; ++i)
+        add(rd(phdrs[i].p_offset), rd(phdrs[i].p_filesz));
+
+    auto shdrs = reinterpret_cast<typename Traits::Shdr*>(contents + rd(ehdr->e_shoff));
+    for (size_t i = 0; i < shnum && fits; ++i) {
+        if (rd(shdrs[i].sh_type) != SHT_NOBITS)
+            add(rd(shdrs[i].sh_offset), rd(shdrs[i].sh_size));
+    }
+
+    if (!fits)
+        return std::nullopt;
+    return extent;
+}
+
+
+inline std::optional<size_t> elf_extent(caddr_t contents, size_t size, std::pair<ElfClass, Endian> el_class) {
+    switch (el_class.first) {
+    case Elf32: return elf_extent<Elf32>(contents, size, el_class.second);
+    case Elf64: return elf_extent<Elf64>(contents, size, el_class.second);
+    default:    return std::nullopt;
+    }
+}
@@ -10,12 +10,16 @@
 #include <cstring>
 
 #include <safe_patchelf/commons.h>
+#include <safe_patchelf/Hash.h>
+#include <safe_patchelf/Summary.h>
 
 template<ElfClass Class, Endian ElfEndian, Endian HostEndian = GetHostEndian::endian>
 class Elf {
 public:
     using Traits = ElfClassTraits<Class>;
     using Results = std::list<std::pair<bool, std::string> >;
+    // Modified bytes: offset in content and length
+    using Ranges = std::vector<std::pair<size_t, size_t> >;
 
     Elf(void *content)
         : content_(reinterpret_cast<caddr_t>(content))
@@ -23,6 +27,7 @@ public:
         , phdrs_()
         , shdrs_()
         , executable_(false)
+        , modified_()
     {
         fill_headers();
     }
@@ -48,10 +53,21 @@ public:
 
     caddr_t section_data(const char* section_name) {
         auto shdr = find_section(section_name);
+        if (!shdr || rdi(shdr->sh_type) == SHT_NOBITS)
+            return nullptr;
         return content_ + rdi(shdr->sh_offset);
     }
 
 
+    // Offset and size of section content in file, std::nullopt when
+    // there is no such section or it has no file content.
+    std::optional<std::pair<size_t, size_t> > section_range(const char* section_name) {
+        auto shdr = find_section(section_name);
+        if (!shdr || rdi(shdr->sh_type) == SHT_NOBITS)
+            return std::nullopt;
+        return std::make_pair(size_t(rdi(shdr->sh_offset)), size_t(rdi(shdr->sh_size)));
+    }
+
     bool set_soname(const char* new_soname) {
         bool result = false;
 
@@ -65,13 +81,14 @@ public:
         if (!dsects)
             return result;
 
-        auto dynamic    = dsects->first;
-        auto dynstr     = dsects->second;
-
         char* soname = nullptr;
-        for (auto dyn = dynamic; rdi(dyn->d_tag) != DT_NULL; ++dyn) {
+        for (auto dyn = dsects->dynamic; dyn != dsects->dynamic_end && rdi(dyn->d_tag) != DT_NULL; ++dyn) {
             if (rdi(dyn->d_tag) == DT_SONAME) {
-                soname = dynstr + rdi(dyn->d_un.d_val);
+                soname = dsects->string_at(rdi(dyn->d_un.d_val));
+                if (!soname) {
+                    error("Soname record points outside of .dynstr section!");
+                    return result;
+                }
                 break;
             }
         }
@@ -114,8 +131,12 @@ public:
                 warning(msg.str());
             }
 
-            if (!has_error)
+            if (!has_error) {
+                std::string old_soname(soname);
                 ::strncpy(soname, new_soname, old_soname_size);
+                touch(soname, old_soname_size);
+                update_verdef_base(*dsects, soname, old_soname);
+            }
 
             result = !has_error;
         }
@@ -130,15 +151,26 @@ public:
         if (!dsects)
             return result;
 
-        auto dynamic    = dsects->first;
-        auto dynstr     = dsects->second;
+        auto dynstr     = dsects->dynstr;
 
         bool updates_result  = true;
         bool has_updates     = false;
 
-        for (auto dyn = dynamic; rdi(dyn->d_tag) != DT_NULL; ++dyn) {
+        Renames renames;
+
+        // All names checked before the first one is changed
+        auto broken = std::find_if(dsects->dynamic, dsects->dynamic_end, [&](auto& dyn) {
+            return rdi(dyn.d_tag) == DT_NEEDED && !dsects->string_at(rdi(dyn.d_un.d_val));
+        });
+        auto null = std::find_if(dsects->dynamic, broken, [&](auto& dyn) { return rdi(dyn.d_tag) == DT_NULL; });
+        if (broken != dsects->dynamic_end && null == broken) {
+            error("Needed record points outside of .dynstr section!");
+            return result;
+        }
+
+        for (auto dyn = dsects->dynamic; dyn != dsects->dynamic_end && rdi(dyn->d_tag) != DT_NULL; ++dyn) {
             if (rdi(dyn->d_tag) == DT_NEEDED) {
-                char *needed_str = dynstr + rdi(dyn->d_un.d_val);
+                char *needed_str = dsects->string_at(rdi(dyn->d_un.d_val));
 
                 std::for_each(replacements.begin(), replacements.end(), [&](auto& it) {
                     if (::strcmp(it.first.c_str(), needed_str) != 0)
@@ -172,7 +204,9 @@ public:
                     }
 
                     if (!has_error) {
+                        renames.push_back({needed_str - dynstr, it.first, it.second});
                         ::strncpy(needed_str, it.second.c_str(), old_needed_size);
+                        touch(needed_str, old_needed_size);
                         has_updates = true;
                     }
 
@@ -183,6 +217,8 @@ public:
 
         if (!has_updates) {
             error("Where no updates in needed!");
+        } else {
+            updates_result &= update_verneeds(*dsects, renames);
         }
 
         result = updates_result & has_updates;
@@ -190,26 +226,486 @@ public:
         return result;
     }
 
+    bool set_interpreter(const char* new_interpreter) {
+        bool result = false;
+
+        auto interp = find_segment(PT_INTERP);
+        if (!interp) {
+            error("Can't find PT_INTERP program header!");
+            return result;
+        }
+
+        char*  interpreter      = content_ + rdi(interp->p_offset);
+        size_t interpreter_room = rdi(interp->p_filesz);
+
+        if (::strncmp(new_interpreter, interpreter, interpreter_room) == 0) {
+            error("New interpreter is equal to original.");
+            return result;
+        }
+
+        // PT_INTERP p_filesz includes the terminating zero
+        size_t new_interpreter_size = ::strlen(new_interpreter);
+        if (new_interpreter_size + 1 > interpreter_room) {
+            std::ostringstream msg;
+            msg << "New interpreter string size ("
+                << "'" << new_interpreter << "' size: "
+                << new_interpreter_size
+                << " bytes) does not fit into PT_INTERP segment ("
+                << interpreter_room
+                << " bytes including terminating zero).";
+            error(msg.str());
+            return result;
+        }
+
+        // strncpy zero pads the rest of the segment
+        ::strncpy(interpreter, new_interpreter, interpreter_room);
+        touch(interpreter, interpreter_room);
+
+        result = true;
+
+        return result;
+    }
+
+    // Must be called after all other updates: the new build-id is a hash
+    // of the final content (with the descriptor itself taken as zeros).
+    bool update_build_id(size_t content_size) {
+        bool result = false;
+
+        auto shdr = find_section(".note.gnu.build-id");
+        if (!shdr || rdi(shdr->sh_type) != SHT_NOTE) {
+            error("Can't find .note.gnu.build-id section!");
+            return result;
+        }
+
+        auto desc = build_id_desc(shdr, content_size);
+        if (!desc) {
+            error("Can't find GNU build-id note!");
+            return result;
+        }
+
+        std::string build_id = compute_build_id(desc->first, desc->second, content_size);
+        ::memcpy(desc->first, build_id.data(), build_id.size());
+        touch(desc->first, desc->second);
+
+        result = true;
+
+        return result;
+    }
+
+    // Read only: true when the GNU build-id note already holds the hash
+    // update_build_id() would write.
+    bool build_id_matches(size_t content_size) {
+        auto shdr = find_section(".note.gnu.build-id");
+        if (!shdr || rdi(shdr->sh_type) != SHT_NOTE)
+            return false;
+
+        auto desc = build_id_desc(shdr, content_size);
+        if (!desc)
+            return false;
+
+        return compute_build_id(desc->first, desc->second, content_size) == std::string(desc->first, desc->second);
+    }
+
+    // Read only: never writes to content, so it may be a PROT_READ mapping.
+    ElfSummary summary(size_t content_size) {
+        ElfSummary result;
+
+        result.elf_class = Traits::name;
+        result.endian    = (ElfEndian == Little) ? "little" : "big";
+        result.machine   = rdi(ehdr_->e_machine);
+        result.type      = rdi(ehdr_->e_type);
+
+        auto interp = find_segment(PT_INTERP);
+        if (interp && rdi(interp->p_offset) < content_size) {
+            size_t room = std::min<size_t>(rdi(interp->p_filesz), content_size - rdi(interp->p_offset));
+            caddr_t str = content_ + rdi(interp->p_offset);
+            result.interp = std::string(str, ::strnlen(str, room));
+        }
+
+        auto dynamic_shdr = find_section(".dynamic");
+        auto dynstr_shdr  = find_section(".dynstr");
+        if (!dynamic_shdr || !dynstr_shdr
+            || rdi(dynamic_shdr->sh_type) == SHT_NOBITS || rdi(dynstr_shdr->sh_type) == SHT_NOBITS
+            || !fits(dynamic_shdr, content_size) || !fits(dynstr_shdr, content_size))
+            return result;
+
+        auto dynamic     = reinterpret_cast<typename Traits::Dyn*>(content_ + rdi(dynamic_shdr->sh_offset));
+        auto dynamic_end = dynamic + rdi(dynamic_shdr->sh_size) / sizeof(typename Traits::Dyn);
+        caddr_t dynstr      = content_ + rdi(dynstr_shdr->sh_offset);
+        size_t  dynstr_size = rdi(dynstr_shdr->sh_size);
+
+        auto string_at = [dynstr, dynstr_size](size_t off) {
+            if (off >= dynstr_size)
+                return std::string();
+            return std::string(dynstr + off, ::strnlen(dynstr + off, dynstr_size - off));
+        };
+
+        for (auto dyn = dynamic; dyn != dynamic_end && rdi(dyn->d_tag) != DT_NULL; ++dyn) {
+            switch (rdi(dyn->d_tag)) {
+            case DT_SONAME:  result.soname  = string_at(rdi(dyn->d_un.d_val)); break;
+            case DT_NEEDED:  result.needed.push_back(string_at(rdi(dyn->d_un.d_val))); break;
+            case DT_RPATH:   result.rpath   = string_at(rdi(dyn->d_un.d_val)); break;
+            case DT_RUNPATH: result.runpath = string_at(rdi(dyn->d_un.d_val)); break;
+            default: break;
+            }
+        }
+
+        return result;
+    }
+
+    // Read only: version names required from each file by .gnu.version_r,
+    // weak references left out.
+    std::map<std::string, std::vector<std::string> > version_needs(size_t content_size) {
+        std::map<std::string, std::vector<std::string> > result;
+
+        auto shdr = find_section(".gnu.version_r");
+        auto strs = dynamic_strings(content_size);
+        if (!shdr || !strs || rdi(shdr->sh_type) == SHT_NOBITS || !fits(shdr, content_size))
+            return result;
+
+        size_t off  = rdi(shdr->sh_offset);
+        size_t end  = off + rdi(shdr->sh_size);
+        size_t vn_num = rdi(shdr->sh_info);
+
+        for (size_t i = 0; i < vn_num && off + sizeof(typename Traits::Verneed) <= end; ++i) {
+            auto vn = reinterpret_cast<typename Traits::Verneed*>(content_ + off);
+            auto& versions = result[strs->at(rdi(vn->vn_file))];
+
+            size_t aux = off + rdi(vn->vn_aux);
+            for (size_t j = 0; j < rdi(vn->vn_cnt) && aux >= off && aux + sizeof(typename Traits::Vernaux) <= end; ++j) {
+                auto vna = reinterpret_cast<typename Traits::Vernaux*>(content_ + aux);
+                if (!(rdi(vna->vna_flags) & VER_FLG_WEAK))
+                    versions.push_back(strs->at(rdi(vna->vna_name)));
+
+                if (!rdi(vna->vna_next))
+                    break;
+                aux += rdi(vna->vna_next);
+            }
+
+            if (!rdi(vn->vn_next))
+                break;
+            off += rdi(vn->vn_next);
+        }
+
+        return result;
+    }
+
+    // Read only: version names defined by .gnu.version_d, the base
+    // (object name) one left out.
+    std::vector<std::string> version_defs(size_t content_size) {
+        std::vector<std::string> result;
+
+        auto shdr = find_section(".gnu.version_d");
+        auto strs = dynamic_strings(content_size);
+        if (!shdr || !strs || rdi(shdr->sh_type) == SHT_NOBITS || !fits(shdr, content_size))
+            return result;
+
+        size_t off  = rdi(shdr->sh_offset);
+        size_t end  = off + rdi(shdr->sh_size);
+        size_t vd_num = rdi(shdr->sh_info);
+
+        for (size_t i = 0; i < vd_num && off + sizeof(typename Traits::Verdef) <= end; ++i) {
+            auto vd = reinterpret_cast<typename Traits::Verdef*>(content_ + off);
+
+            size_t aux = off + rdi(vd->vd_aux);
+            if (!(rdi(vd->vd_flags) & VER_FLG_BASE) && rdi(vd->vd_cnt) > 0
+                && aux >= off && aux + sizeof(typename Traits::Verdaux) <= end) {
+                auto vda = reinterpret_cast<typename Traits::Verdaux*>(content_ + aux);
+                result.push_back(strs->at(rdi(vda->vda_name)));
+            }
+
+            if (!rdi(vd->vd_next))
+                break;
+            off += rdi(vd->vd_next);
+        }
+
+        return result;
+    }
+
+    // Sorted, merged ranges of bytes written so far
+    Ranges modified_ranges() const {
+        Ranges ranges(modified_);
+        std::sort(ranges.begin(), ranges.end());
+
+        Ranges merged;
+        std::for_each(ranges.begin(), ranges.end(), [&merged](auto& r) {
+            if (!merged.empty() && r.first <= merged.back().first + merged.back().second)
+                merged.back().second = std::max(merged.back().second, r.first + r.second - merged.back().first);
+            else
+                merged.push_back(r);
+        });
+        return merged;
+    }
+
     const Results& results() const {
         return results_;
     }
 
 protected:
 
-    std::optional<std::pair<typename Traits::Dyn*, caddr_t> > get_dynamic_sections() {
-        auto dynamic    = reinterpret_cast<typename Traits::Dyn*>(section_data(".dynamic"));
-        if (!dynamic) {
+    // Dynamic string renamed in place: offset in .dynstr, old and new value
+    struct Rename {
+        ptrdiff_t   offset;
+        std::string from;
+        std::string to;
+    };
+    using Renames = std::vector<Rename>;
+
+    // .dynamic entries up to the end of the section and .dynstr. Section
+    // contents are trusted to lie inside of the content, callers check
+    // that (elf_extent()) before any edit; offsets read from them are not.
+    struct DynamicSections {
+        typename Traits::Dyn* dynamic;
+        typename Traits::Dyn* dynamic_end;
+        caddr_t dynstr;
+        size_t  dynstr_size;
+
+        // String terminated inside of .dynstr, nullptr otherwise
+        char* string_at(size_t off) const {
+            if (off >= dynstr_size || !::memchr(dynstr + off, '\0', dynstr_size - off))
+                return nullptr;
+            return dynstr + off;
+        }
+    };
+
+    // SysV ELF hash, used for vd_hash/vna_hash
+    static typename Traits::Word elf_hash(const char* name) {
+        typename Traits::Word h = 0;
+        for (auto p = reinterpret_cast<const unsigned char*>(name); *p; ++p) {
+            h = (h << 4) + *p;
+            typename Traits::Word g = h & 0xf0000000;
+            if (g)
+                h ^= g >> 24;
+            h &= ~g;
+        }
+        return h;
+    }
+
+    static bool overlaps(const Renames& renames, ptrdiff_t offset, size_t size) {
+        return std::any_of(renames.begin(), renames.end(), [offset, size](auto& r) {
+            return offset < r.offset + ptrdiff_t(r.from.size())
+                && r.offset < offset + ptrdiff_t(size);
+        });
+    }
+
+    // Walk .gnu.version_r once: point every vn_file naming a renamed
+    // DT_NEEDED to the new name and refresh vna_hash for every version
+    // name whose bytes were changed by the renames. Entries and names are
+    // followed only as long as they stay inside of their sections.
+    bool update_verneeds(const DynamicSections& dsects, Renames& renames) {
+        auto shdr = find_section(".gnu.version_r");
+        if (!shdr || rdi(shdr->sh_type) == SHT_NOBITS)
+            return true;
+
+        bool result = true;
+
+        caddr_t dynstr = dsects.dynstr;
+        size_t  off    = rdi(shdr->sh_offset);
+        size_t  end    = off + rdi(shdr->sh_size);
+        size_t  vn_num = rdi(shdr->sh_info);
+
+        for (size_t i = 0; i < vn_num && off + sizeof(typename Traits::Verneed) <= end; ++i) {
+            auto vn = reinterpret_cast<typename Traits::Verneed*>(content_ + off);
+            char* vn_file = dsects.string_at(rdi(vn->vn_file));
+            if (!vn_file) {
+                error("Version needs file name points outside of .dynstr section!");
+                return false;
+            }
+
+            auto it = std::find_if(renames.begin(), renames.end(), [vn_file](auto& r) {
+                return ::strcmp(r.from.c_str(), vn_file) == 0;
+            });
+            // Separate copy of the old string (not shared with DT_NEEDED)
+            if (it != renames.end()) {
+                Rename r{vn_file - dynstr, it->from, it->to};
+                ::strncpy(vn_file, r.to.c_str(), r.from.size());
+                touch(vn_file, r.from.size());
+                renames.push_back(std::move(r));
+            }
+
+            auto found = std::any_of(renames.begin(), renames.end(), [vn_file](auto& r) {
+                return ::strcmp(r.to.c_str(), vn_file) == 0;
+            });
+            if (!found && overlaps(renames, vn_file - dynstr, ::strlen(vn_file))) {
+                std::ostringstream msg;
+                msg << "Version needs file name '" << vn_file << "' is damaged by needed renames.";
+                error(msg.str());
+                result = false;
+            }
+
+            size_t aux = off + rdi(vn->vn_aux);
+            for (size_t j = 0; j < rdi(vn->vn_cnt) && aux >= off && aux + sizeof(typename Traits::Vernaux) <= end; ++j) {
+                auto vna = reinterpret_cast<typename Traits::Vernaux*>(content_ + aux);
+                char* vna_name = dsects.string_at(rdi(vna->vna_name));
+                if (!vna_name) {
+                    error("Version needs name points outside of .dynstr section!");
+                    return false;
+                }
+
+                if (overlaps(renames, vna_name - dynstr, ::strlen(vna_name))) {
+                    vna->vna_hash = wdi(elf_hash(vna_name));
+                    touch(&vna->vna_hash, sizeof(vna->vna_hash));
+                }
+
+                if (!rdi(vna->vna_next))
+                    break;
+                aux += rdi(vna->vna_next);
+            }
+
+            if (!rdi(vn->vn_next))
+                break;
+            off += rdi(vn->vn_next);
+        }
+
+        return result;
+    }
+
+    // The VER_FLG_BASE entry of .gnu.version_d names the object itself,
+    // keep its name and vd_hash equal to the new soname.
+    void update_verdef_base(const DynamicSections& dsects, const char* soname, const std::string& old_soname) {
+        auto shdr = find_section(".gnu.version_d");
+        if (!shdr || rdi(shdr->sh_type) == SHT_NOBITS)
+            return;
+
+        size_t off    = rdi(shdr->sh_offset);
+        size_t end    = off + rdi(shdr->sh_size);
+        size_t vd_num = rdi(shdr->sh_info);
+
+        for (size_t i = 0; i < vd_num && off + sizeof(typename Traits::Verdef) <= end; ++i) {
+            auto vd = reinterpret_cast<typename Traits::Verdef*>(content_ + off);
+
+            size_t aux = off + rdi(vd->vd_aux);
+            if ((rdi(vd->vd_flags) & VER_FLG_BASE) && rdi(vd->vd_cnt) > 0
+                && aux >= off && aux + sizeof(typename Traits::Verdaux) <= end) {
+                auto vda = reinterpret_cast<typename Traits::Verdaux*>(content_ + aux);
+                char* vda_name = dsects.string_at(rdi(vda->vda_name));
+                if (!vda_name) {
+                    warning("Version definition base name points outside of .dynstr section.");
+                    return;
+                }
+
+                // Separate copy of the old string (not shared with DT_SONAME)
+                if (vda_name != soname && old_soname == vda_name) {
+                    ::memmove(vda_name, soname, old_soname.size());
+                    touch(vda_name, old_soname.size());
+                }
+
+                if (::strcmp(vda_name, soname) != 0) {
+                    std::ostringstream msg;
+                    msg << "Version definition base name '" << vda_name
+                        << "' does not match soname '" << soname << "'.";
+                    warning(msg.str());
+                    return;
+                }
+
+                vd->vd_hash = wdi(elf_hash(vda_name));
+                touch(&vd->vd_hash, sizeof(vd->vd_hash));
+                return;
+            }
+
+            if (!rdi(vd->vd_next))
+                break;
+            off += rdi(vd->vd_next);
+        }
+    }
+
+    // Descriptor of the NT_GNU_BUILD_ID note inside of the note section
+    std::optional<std::pair<caddr_t, size_t> > build_id_desc(typename Traits::Shdr* shdr, size_t content_size) {
+        if (!fits(shdr, content_size))
+            return std::nullopt;
+
+        caddr_t note     = content_ + rdi(shdr->sh_offset);
+        caddr_t note_end = note + rdi(shdr->sh_size);
+
+        while (note + sizeof(typename Traits::Nhdr) <= note_end) {
+            auto nhdr = reinterpret_cast<typename Traits::Nhdr*>(note);
+            size_t namesz = rdi(nhdr->n_namesz);
+            size_t descsz = rdi(nhdr->n_descsz);
+            caddr_t name  = note + sizeof(typename Traits::Nhdr);
+            caddr_t data  = name + ((namesz + 3) & ~size_t(3));
+
+            if (rdi(nhdr->n_type) == NT_GNU_BUILD_ID && namesz == sizeof(ELF_NOTE_GNU)
+                && ::memcmp(name, ELF_NOTE_GNU, namesz) == 0) {
+                if (descsz == 0 || data + descsz > content_ + content_size)
+                    return std::nullopt;
+                return std::make_pair(data, descsz);
+            }
+
+            note = data + ((descsz + 3) & ~size_t(3));
+        }
+
+        return std::nullopt;
+    }
+
+    // Hash of the whole content with the descriptor itself taken as zeros
+    std::string compute_build_id(caddr_t desc, size_t desc_size, size_t content_size) {
+        size_t desc_off = desc - content_;
+
+        StreamHash hash;
+        hash.update(content_, desc_off);
+        hash.update_zeros(desc_size);
+        hash.update(desc + desc_size, content_size - desc_off - desc_size);
+
+        std::string build_id(desc_size, '\0');
+        hash.fill(&build_id[0], build_id.size());
+        return build_id;
+    }
+
+    // Bounded reader of .dynstr strings
+    struct DynamicStrings {
+        caddr_t data;
+        size_t  size;
+
+        std::string at(size_t off) const {
+            if (off >= size)
+                return std::string();
+            return std::string(data + off, ::strnlen(data + off, size - off));
+        }
+    };
+
+    std::optional<DynamicStrings> dynamic_strings(size_t content_size) {
+        auto shdr = find_section(".dynstr");
+        if (!shdr || rdi(shdr->sh_type) == SHT_NOBITS || !fits(shdr, content_size))
+            return std::nullopt;
+        return DynamicStrings{content_ + rdi(shdr->sh_offset), size_t(rdi(shdr->sh_size))};
+    }
+
+    bool fits(typename Traits::Shdr* shdr, size_t content_size) {
+        size_t off = rdi(shdr->sh_offset);
+        size_t len = rdi(shdr->sh_size);
+        return off <= content_size && len <= content_size - off;
+    }
+
+    typename Traits::Phdr* find_segment(typename Traits::Word p_type) {
+        auto it = std::find_if(phdrs_.begin(), phdrs_.end(), [this, p_type](auto* phdr){
+            return rdi(phdr->p_type) == p_type;
+        });
+        if (it != phdrs_.end())
+            return *it;
+        else
+            return nullptr;
+    }
+
+    std::optional<DynamicSections> get_dynamic_sections() {
+        auto dynamic_shdr = find_section(".dynamic");
+        if (!dynamic_shdr || rdi(dynamic_shdr->sh_type) == SHT_NOBITS) {
             error("Can't find .dynamic section!");
             return std::nullopt;
         }
 
-        auto dynstr     = section_data(".dynstr");
-        if (!dynstr) {
+        auto dynstr_shdr  = find_section(".dynstr");
+        if (!dynstr_shdr || rdi(dynstr_shdr->sh_type) == SHT_NOBITS) {
             error("Can't find .dynstr section!");
             return std::nullopt;
         }
 
-        return std::make_pair(dynamic, dynstr);
+        auto dynamic = reinterpret_cast<typename Traits::Dyn*>(content_ + rdi(dynamic_shdr->sh_offset));
+        return DynamicSections{dynamic, dynamic + rdi(dynamic_shdr->sh_size) / sizeof(typename Traits::Dyn),
+                               content_ + rdi(dynstr_shdr->sh_offset), size_t(rdi(dynstr_shdr->sh_size))};
+    }
+
+    void touch(const void* ptr, size_t len) {
+        modified_.push_back(std::make_pair(reinterpret_cast<const char*>(ptr) - content_, len));
     }
 
     void warning(std::string message) const {
@@ -252,6 +748,7 @@ private:
     std::vector<typename Traits::Phdr*> phdrs_;
     std::vector<typename Traits::Shdr*> shdrs_;
     bool executable_;
+    Ranges modified_;
 
     mutable Results results_;
 };
@@ -6,6 +6,7 @@
 #include <unistd.h>
 
 #include <map>
+#include <string>
 
 class FD {
 public:
@@ -14,6 +15,7 @@ public:
     explicit FD(int initial = BAD);
 
     FD(FD&& src);
+    FD& operator=(FD&& src);
     ~FD();
 
     void close();
@@ -27,6 +29,15 @@ public:
 
     void* mmap(off_t off = 0, size_t in_len = 0, int prot = PROT_READ, int flags = MAP_FILE | MAP_SHARED);
 
+    // Start read ahead of the mapping pages which are not in page cache yet.
+    // Does nothing when the whole mapping is resident.
+    void prefetch(void* addr) const;
+
+    // New file with a unique name next to path, for writing aside and
+    // renaming over path. Gets the mode of path, or 0666 less the umask
+    // when path doesn't exist yet. tmp receives the name.
+    static FD temp_beside(const std::string& path, std::string& tmp);
+
 private:
     // Do not copy
     FD(const FD&) = delete;
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <iostream>
+
+#include <safe_patchelf/Args.h>
+
+// ELF images embedded at arbitrary offsets of raw blobs (bootloader and
+// firmware bundles). The blob is mapped once and searched for the ELF
+// magic with memmem, candidates are accepted when elf_class() and the
+// header, segment and section bounds check out (elf_extent()), then a
+// matched image is skipped as a whole. Images are patched in parallel
+// over their sub ranges and the modified ranges are written back in
+// place, the blob never changes size.
+class Firmware {
+public:
+    struct Image {
+        size_t offset;
+        size_t size;
+    };
+
+    struct Stats {
+        size_t images = 0;
+        size_t changed = 0;
+        size_t failed = 0;
+    };
+
+    // Blobs given by Args::filenames one after the other
+    static int run(const Args& args);
+
+    static int patch(const std::string& path, const Args& args, std::ostream& out = std::cout,
+                     std::ostream& err = std::cerr, Stats* stats = nullptr);
+
+    static std::vector<Image> find_images(const char* content, size_t size);
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <ostream>
+#include <iostream>
+#include <unordered_map>
+
+#include <safe_patchelf/Args.h>
+#include <safe_patchelf/StringPool.h>
+#include <safe_patchelf/ScanCache.h>
+
+// Dependency graph of all dynamic ELF objects inside of a sysroot.
+// DT_NEEDED entries are resolved the way ld.so does it, but relative to the
+// root and without executing anything: DT_RPATH (when there is no
+// DT_RUNPATH), DT_RUNPATH, /etc/ld.so.conf directories and default
+// directories. Symlinks are resolved in memory, absolute link targets are
+// taken relative to the root.
+class DepGraph {
+public:
+    using Id = StringPool::Id;
+    enum : Id { NONE = StringPool::NONE };
+
+    struct Node {
+        Id path;                    // path relative to the root, starts with '/'
+        unsigned elf_class = 0;
+        unsigned machine = 0;
+        Id soname = NONE;
+        std::vector<Id> needed;
+        std::vector<Id> search;     // rpath/runpath directories, not expanded
+        bool runpath = false;
+        std::vector<Id> deps;       // resolved provider node per needed (NONE when missing)
+    };
+
+    struct Problem {
+        enum Type { Missing, Ambiguous, Cycle } type;
+        std::vector<Id> nodes;      // Missing/Ambiguous: user node first then providers
+        Id needed = NONE;
+    };
+
+    static int run(const Args& args);
+
+    explicit DepGraph(std::string root);
+
+    // False when the root couldn't be walked completely or holds no ELF
+    // objects, reported to err
+    bool scan(unsigned jobs, std::ostream& err = std::cerr, ScanCache* cache = nullptr);
+
+    void resolve();
+
+    void find_cycles();
+
+    void report(std::ostream& out) const;
+
+    const std::vector<Node>& nodes() const { return nodes_; }
+    const std::vector<Problem>& problems() const { return problems_; }
+    const StringPool& strings() const { return strings_; }
+
+    // Node index of the regular file path (relative to the root) after
+    // resolving symlinks, NONE when it is not a scanned ELF object.
+    Id lookup(const std::string& path) const;
+
+    // Library directories listed by conf (relative to the root) and the
+    // files it includes.
+    static void load_ld_so_conf(const std::string& root, const std::string& conf, std::vector<std::string>& dirs, int depth = 0);
+
+private:
+    std::optional<std::string> realpath(const std::string& path) const;
+    std::vector<std::string> default_dirs(const Node& node) const;
+    std::string expand(const std::string& dir, const Node& node) const;
+
+    std::string root_;
+    StringPool strings_;
+    std::vector<Node> nodes_;
+    std::unordered_map<std::string, Id> node_by_path_;
+    std::unordered_map<std::string, std::string> links_;
+    std::vector<std::string> conf_dirs_;
+    std::vector<Problem> problems_;
+    size_t edges_ = 0;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Streaming XXH64. Fast non cryptographic hash used for build-id.
+class Xxh64 {
+public:
+    explicit Xxh64(uint64_t seed = 0);
+
+    void update(const void* data, size_t len);
+    void update_zeros(size_t len);
+
+    uint64_t digest() const;
+
+private:
+    void consume(const uint8_t* block);
+
+    uint64_t v_[4];
+    uint64_t seed_;
+    uint64_t total_;
+    uint8_t  buf_[32];
+    size_t   buf_len_;
+};
+
+// Two independent XXH64 lanes fed in the same pass, expanded to any
+// requested length. Used to regenerate build-id descriptors.
+class StreamHash {
+public:
+    StreamHash();
+
+    void update(const void* data, size_t len);
+    void update_zeros(size_t len);
+
+    void fill(void* out, size_t len) const;
+
+private:
+    Xxh64 lo_;
+    Xxh64 hi_;
+};
+
+// Streaming SHA-256. Used for content digests of patched files.
+class Sha256 {
+public:
+    enum { DIGEST_SIZE = 32 };
+
+    Sha256();
+
+    void update(const void* data, size_t len);
+
+    void digest(uint8_t out[DIGEST_SIZE]);
+
+    std::string hex_digest();
+
+private:
+    void consume(const uint8_t* block);
+
+    uint32_t state_[8];
+    uint64_t total_;
+    uint8_t  buf_[64];
+    size_t   buf_len_;
+};
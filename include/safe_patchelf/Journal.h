@@ -0,0 +1,71 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <optional>
+#include <mutex>
+#include <unordered_map>
+
+#include <safe_patchelf/Args.h>
+#include <safe_patchelf/Walker.h>
+#include <safe_patchelf/ScanCache.h>
+#include <safe_patchelf/Summary.h>
+
+// Incremental patch mode: per path identity and result of the last run
+// plus fingerprints of the rules it was run with.
+//
+// The file is NDJSON, a header line with the rules followed by one line per
+// processed path with the identity and dynamic strings after patching. A
+// rerun skips paths whose identity did not change, unless one of the
+// changed or added rules may apply to the recorded strings.
+class Journal {
+public:
+    // NoOp: ELF file left untouched, already in the requested state or
+    // none of the rules apply to it
+    enum Result { Ok, Error, NotElf, NoOp };
+
+    struct Record {
+        ScanCache::Key key;
+        Result result = Error;
+        std::optional<std::string> soname;
+        std::vector<std::string> needed;
+        std::optional<std::string> interp;
+    };
+
+    // One fingerprint per rule: "soname", "interpreter", "build-id" and
+    // "needed:<old>" for each DT_NEEDED replacement.
+    static std::map<std::string, uint64_t> rules_of(const Args& args);
+
+    Journal() = default;
+
+    bool load(const std::string& path);
+
+    // Rules of this run, computes the ones changed since the loaded journal
+    void begin(const Args& args);
+
+    // True when the path may be skipped, its recorded result was a success
+    // or a no-op.
+    bool unchanged(const Walker::Entry& entry) const;
+
+    // Thread safe.
+    void record(const std::string& path, const struct ::stat& st, Result result, const ElfSummary* summary = nullptr);
+
+    bool save(const std::string& path) const;
+
+private:
+    bool affected(const Record& record) const;
+
+    std::map<std::string, uint64_t> loaded_rules_;
+    std::map<std::string, uint64_t> rules_;
+    std::vector<std::string> changed_;
+    bool changed_all_ = false;
+
+    std::unordered_map<std::string, Record> records_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Record> updates_;
+};
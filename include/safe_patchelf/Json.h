@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <optional>
+#include <cstdint>
+
+// Minimal JSON helpers for NDJSON records and small documents.
+struct Json {
+    // Parsed document. Numbers keep their source text so 64 bit values
+    // round trip exactly, object members keep their order.
+    struct Value {
+        enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+
+        bool boolean = false;
+        std::string string;                                 // String, Number text
+        std::vector<Value> array;
+        std::vector<std::pair<std::string, Value> > object;
+
+        static Value of(const std::string& s);
+        static Value of(uint64_t n);
+
+        const Value* get(const std::string& key) const;
+        Value* get(const std::string& key);
+
+        // Replaces existing member or appends a new one
+        void set(const std::string& key, Value value);
+
+        std::optional<uint64_t> as_u64() const;
+    };
+
+    static std::string escape(const std::string& s);
+
+    static std::ostream& quoted(std::ostream& out, const std::string& s);
+
+    static std::optional<Value> parse(const std::string& text);
+
+    // Compact form, no whitespace
+    static void write(std::ostream& out, const Value& value);
+};
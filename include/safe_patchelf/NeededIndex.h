@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <iostream>
+
+#include <safe_patchelf/Args.h>
+#include <safe_patchelf/FD.h>
+#include <safe_patchelf/ScanCache.h>
+
+// Persistent reverse dependency index: DT_NEEDED soname -> files.
+//
+// The file holds the per path identity and DT_NEEDED list plus a sorted
+// soname table with posting lists, so a lookup is a binary search in the
+// read only mapping. Updates rescan only the paths whose identity changed
+// and rewrite the whole file.
+class NeededIndex {
+public:
+    struct Stats {
+        size_t files = 0;
+        size_t rescanned = 0;
+        size_t removed = 0;
+        bool failed = false;        // some path under the roots couldn't be read
+    };
+
+    // Update or lookup (--who-needs) mode
+    static int run(const Args& args);
+
+    // Batch rename of exactly the indexed files needing the old names
+    static int patch(const Args& args);
+
+    NeededIndex() = default;
+
+    bool load(const std::string& path);
+
+    // Paths of the files with DT_NEEDED equal to soname, sorted. Paths
+    // outside of the roots are left out unless roots is empty.
+    std::vector<std::string> who_needs(const std::string& soname, const std::vector<std::string>& roots = {}) const;
+
+    // Walks roots, rescans files with changed identity in parallel and
+    // drops indexed paths under roots that are gone. Nothing is dropped
+    // when part of the walk failed, a vanished root is not an empty one.
+    Stats update(const std::vector<std::string>& roots, unsigned jobs, std::ostream& err = std::cerr);
+
+    bool save(const std::string& path) const;
+
+private:
+    struct Header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t file_count;
+        uint64_t name_count;
+        uint64_t needs_count;
+        uint64_t postings_count;
+        uint64_t files_off;
+        uint64_t names_off;
+        uint64_t needs_off;
+        uint64_t postings_off;
+        uint64_t strings_off;
+        uint64_t strings_size;
+    };
+
+    struct FileRecord {
+        ScanCache::Key key;
+        uint64_t path_off;          // into strings
+        uint32_t path_len;
+        uint32_t elf;
+        uint32_t needs_first;       // into needs, name ids
+        uint32_t needs_count;
+    };
+
+    struct NameRecord {
+        uint64_t str_off;           // into strings
+        uint32_t str_len;
+        uint32_t posting_count;
+        uint64_t posting_first;     // into postings, file ids
+    };
+
+    struct File {
+        ScanCache::Key key;
+        bool elf = false;
+        std::vector<std::string> needed;
+    };
+
+    static bool under(const std::string& path, const std::vector<std::string>& roots);
+
+    std::string string_at(uint64_t off, uint32_t len) const;
+
+    // Mapped tables to in memory files, once before the first update
+    void decode();
+
+    FD fd_;
+    const Header* header_ = nullptr;
+    const char* base_ = nullptr;
+
+    bool decoded_ = false;
+    std::map<std::string, File> files_;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <ostream>
+#include <iostream>
+
+#include <safe_patchelf/Args.h>
+
+// Patching of container images in OCI image layout directories.
+//
+// All tar layers referenced from index.json (through nested indexes and
+// manifests) are run through the streaming tar patcher in parallel. The
+// compressed and uncompressed sha256 digests of each new layer are taken
+// while it is written, so no blob is read twice. Layers without any
+// patched ELF member are dropped and keep their blob. Members failing to
+// patch are reported with their layer and stay unchanged, the patched
+// ones of the same layer are kept. For changed layers
+// the config (rootfs.diff_ids), the manifests and indexes referring to
+// them get new blobs and index.json is replaced. Old blobs are left for
+// garbage collection since other images may still use them.
+class Oci {
+public:
+    // Layouts given by Args::filenames one after the other
+    static int run(const Args& args);
+
+    static int patch(const std::string& layout, const Args& args, std::ostream& out = std::cout,
+                     std::ostream& err = std::cerr);
+};
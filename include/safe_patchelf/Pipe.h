@@ -0,0 +1,17 @@
+#pragma once
+
+#include <safe_patchelf/Args.h>
+
+// Single ELF file from stdin to stdout ("-f -"), for build rules with
+// the binary on a pipe.
+//
+// A regular file on stdin is mapped, anything else is read into an
+// anonymous mapping grown with mremap, so growing never copies. Only the
+// modified ranges are written from memory; unchanged ranges go out with
+// splice/copy_file_range from a regular input file, or with vmsplice of
+// the buffer pages when stdout is a pipe. Nothing is written when the
+// input fails to patch. Messages go to stderr.
+class Pipe {
+public:
+    static int run(const Args& args);
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <ostream>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <safe_patchelf/Hash.h>
+
+// Recorded byte level edits keyed by SHA-256 of the input content.
+//
+// A plan is recorded once by a regular patch run and replayed on byte
+// identical inputs without parsing ELF at all: the content hash and the
+// old bytes are verified, then the new bytes are written with pwrite.
+// Content already equal to the recorded output is left untouched.
+//
+// File layout (host byte order): magic, version, entry count, then per
+// entry input hash, output hash, size, edit count and the edits as
+// (offset, length, old bytes, new bytes).
+class Plan {
+public:
+    struct Edit {
+        uint64_t offset;
+        std::string old_bytes;
+        std::string new_bytes;
+    };
+
+    struct Entry {
+        std::string in_sha256;      // raw digest
+        std::string out_sha256;     // raw digest
+        uint64_t size = 0;
+        std::vector<Edit> edits;
+    };
+
+    enum Replayed {
+        Applied,
+        AlreadyApplied,
+        NoPlan,
+        Failed,
+    };
+
+    static std::string sha256(const char* content, size_t size);
+
+    Plan() = default;
+
+    bool load(const std::string& path);
+
+    // Thread safe.
+    void add(Entry entry);
+
+    bool save(const std::string& path) const;
+
+    bool empty() const { return entries_.empty(); }
+
+    Replayed replay(const std::string& path, std::ostream& err = std::cerr) const;
+
+private:
+    std::vector<Entry> entries_;
+    std::unordered_map<std::string, size_t> by_input_;
+    std::unordered_map<std::string, size_t> by_output_;
+    std::unordered_set<uint64_t> sizes_;
+
+    mutable std::mutex mutex_;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <optional>
+
+#include <safe_patchelf/Args.h>
+#include <safe_patchelf/Summary.h>
+#include <safe_patchelf/Walker.h>
+#include <safe_patchelf/ScanCache.h>
+
+// Read only inventory mode: one NDJSON record per ELF file.
+class Query {
+public:
+    static int run(const Args& args);
+
+    // Maps file PROT_READ/MAP_PRIVATE. Returns std::nullopt and sets error
+    // for non ELF (not_elf is set too) or broken files.
+    static std::optional<ElfSummary> query_file(const std::string& path, std::string& error, bool* not_elf = nullptr);
+
+    // Summary of already mapped and checked (elf_headers_fit) content.
+    static ElfSummary summarize(caddr_t content, size_t size);
+
+    // Same as query_file, but answered from the cache without opening the file when its
+    // identity did not change. Fresh results are recorded into the cache.
+    static std::optional<ElfSummary> query_entry(const Walker::Entry& entry, ScanCache* cache, std::string& error);
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <optional>
+#include <mutex>
+#include <unordered_map>
+
+#include <safe_patchelf/FD.h>
+#include <safe_patchelf/Summary.h>
+
+// Persistent per-file scan results keyed by file identity
+// (st_dev, st_ino) and validated by (st_size, st_mtim).
+//
+// The file is an open addressing hash table of fixed size records followed
+// by a blob area with encoded dynamic summaries. It is mapped read only and
+// looked up in place, there is no load step. Results of the current run are
+// kept aside and merged into a new file by save().
+class ScanCache {
+public:
+    enum Kind : uint32_t {
+        Empty   = 0,
+        NotElf  = 1,
+        IsElf   = 2,
+    };
+
+    struct Key {
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t size;
+        uint64_t mtime_ns;
+
+        static Key of(const struct ::stat& st);
+    };
+
+    struct Record {
+        Key      key;
+        uint32_t kind;
+        uint8_t  elf_class;     // 32 or 64, 0 when no summary
+        uint8_t  endian;        // Endian
+        uint16_t machine;
+        uint16_t type;
+        uint16_t reserved;
+        uint32_t summary_len;
+        uint64_t summary_off;   // into blob area
+        uint64_t rules;         // Args::fingerprint() the file is known to match, 0 if none
+    };
+
+    struct Lookup {
+        const Record* record;
+        const char*   summary;  // encoded summary, points into the mapping
+    };
+
+    ScanCache() = default;
+
+    bool load(const std::string& path);
+
+    // Thread safe. Results recorded by this run take precedence.
+    std::optional<Record> find(const struct ::stat& st, std::optional<ElfSummary>* summary = nullptr) const;
+
+    // Thread safe.
+    void record_not_elf(const struct ::stat& st);
+    void record_elf(const struct ::stat& st, const ElfSummary& summary, uint64_t rules = 0);
+
+    bool save(const std::string& path) const;
+
+    static std::string encode(const ElfSummary& summary);
+    static ElfSummary decode(const Record& record, const char* data);
+
+private:
+    struct Header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t record_size;
+        uint64_t buckets;
+        uint64_t blob_offset;
+        uint64_t blob_size;
+    };
+
+    struct KeyHash {
+        size_t operator()(const std::pair<uint64_t, uint64_t>& k) const;
+    };
+
+    std::optional<Lookup> find_mapped(const Key& key) const;
+
+    FD fd_;
+    const Header* header_ = nullptr;
+    const Record* records_ = nullptr;
+    const char* blob_ = nullptr;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::pair<uint64_t, uint64_t>, std::pair<Record, std::string>, KeyHash> updates_;
+};
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+// Runs independent tasks 0..count-1 on a fixed number of threads.
+class Scheduler {
+public:
+    static unsigned default_jobs();
+
+    static void run(size_t count, unsigned jobs, const std::function<void(size_t)>& task);
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Interns strings to dense 32 bit ids. Not thread safe.
+class StringPool {
+public:
+    using Id = uint32_t;
+    enum : Id { NONE = Id(-1) };
+
+    Id intern(const std::string& s);
+
+    // NONE when the string was never interned
+    Id find(const std::string& s) const;
+
+    const std::string& str(Id id) const;
+
+    size_t size() const;
+
+private:
+    std::unordered_map<std::string, Id> ids_;
+    std::vector<const std::string*> strings_;
+};
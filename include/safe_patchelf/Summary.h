@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <ostream>
+
+// Read only view of the dynamic linking related data of ELF file.
+struct ElfSummary {
+    std::string elf_class;
+    std::string endian;
+    unsigned    machine = 0;
+    unsigned    type    = 0;
+
+    std::optional<std::string> soname;
+    std::vector<std::string>   needed;
+    std::optional<std::string> rpath;
+    std::optional<std::string> runpath;
+    std::optional<std::string> interp;
+
+    static const char* machine_name(unsigned machine);
+
+    // Single line JSON object (NDJSON record)
+    void print_json(std::ostream& out, const std::string& filename) const;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <ostream>
+#include <iostream>
+
+#include <safe_patchelf/Args.h>
+
+// Streaming patching of tar archives, one sequential pass without
+// extraction. Headers are parsed incrementally, non ELF members are
+// passed through (splice when one side is a pipe, large copies
+// otherwise), ELF members are buffered, patched in memory and written
+// back with the same size and headers.
+//
+// gzip, xz and zstd compressed archives are recognized by their magic
+// and run through a decompress -> filter -> compress pipeline with the
+// stages on separate threads.
+class Tar {
+public:
+    enum { BLOCK = 512 };
+
+    struct Stats {
+        size_t members = 0;
+        size_t elf = 0;
+        size_t changed = 0;
+        size_t failed = 0;
+        bool complete = false;      // whole archive written, failed members unchanged
+    };
+
+    // sha256 of the output while it is written, hex
+    struct Digests {
+        std::string uncompressed;   // plain archive
+        std::string compressed;     // bytes written to out, same as above when not compressed
+        uint64_t size = 0;          // bytes written to out
+    };
+
+    // stdin to stdout
+    static int run(const Args& args);
+
+    // Plain or compressed archive from in to out, same compression. The
+    // output is hashed on the way when digests are asked for.
+    static int stream(int in, int out, const Args& args, std::ostream& err = std::cerr, Stats* stats = nullptr,
+                      Digests* digests = nullptr);
+
+    // Plain archive, prefix holds bytes already read from in. Members
+    // failing to patch are written unchanged and make the result non
+    // zero. Malformed archives stop the copy with -1. With more than one
+    // job ELF members are patched in parallel, output order is kept.
+    static int filter(int in, int out, const Args& args, std::ostream& err = std::cerr, Stats* stats = nullptr,
+                      const std::string& prefix = std::string(), unsigned jobs = 1);
+
+    // Exactly len bytes from in to out
+    static bool pass(int in, int out, size_t len);
+
+    static bool read_full(int fd, void* buf, size_t len);
+    static bool write_full(int fd, const void* buf, size_t len);
+};
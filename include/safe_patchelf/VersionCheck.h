@@ -0,0 +1,43 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+// Checks that renamed DT_NEEDED targets define every symbol version the
+// patched object requires from the old name (.gnu.version_r against the
+// target's .gnu.version_d). Targets are resolved like ld.so does it on the
+// running system, with the given library path searched first. Version
+// definitions of each library are parsed once and shared by all checks.
+class VersionCheck {
+public:
+    struct Defs {
+        unsigned elf_class = 0;
+        unsigned machine = 0;
+        std::unordered_set<std::string> versions;
+    };
+
+    explicit VersionCheck(std::vector<std::string> library_path);
+
+    // Thread safe. One message per problem, empty when all versions are
+    // provided. content must be mapped and checked (elf_headers_fit).
+    std::vector<std::string> check(caddr_t content, size_t size, const std::string& path,
+                                   const std::map<std::string, std::string>& renames);
+
+private:
+    // nullptr when path is not a readable ELF object
+    std::shared_ptr<const Defs> defs(const std::string& path);
+
+    std::vector<std::string> library_path_;
+    std::vector<std::string> conf_dirs_;
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<const Defs> > by_path_;
+};
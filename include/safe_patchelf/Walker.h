@@ -0,0 +1,37 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <iostream>
+
+// Expands input paths to the list of regular files. Directories are walked
+// recursively, symlinks found inside of directories are not followed (they
+// are reported as entries with S_ISLNK st_mode when with_symlinks is set).
+class Walker {
+public:
+    struct Entry {
+        std::string path;
+        struct ::stat st;
+        // Found by walking a directory (not named explicitly)
+        bool from_dir;
+    };
+
+    // Paths sharing one inode, first collected one first
+    using Group = std::vector<const Entry*>;
+
+    // failed is set when a path can't be stat'ed or a directory can't be
+    // read, those are reported to err and left out.
+    static std::vector<Entry> collect(const std::vector<std::string>& paths, std::ostream& err = std::cerr, bool with_symlinks = false,
+                                      bool* failed = nullptr);
+
+    // Hardlinks (and paths named more than once) end up in one group so
+    // each inode is processed exactly once. Keeps collection order.
+    static std::vector<Group> group_by_inode(const std::vector<Entry>& entries);
+
+private:
+    static bool walk(int dirfd, const std::string& path, std::vector<Entry>& out, std::ostream& err, bool with_symlinks);
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <ostream>
+#include <iostream>
+
+#include <safe_patchelf/Args.h>
+
+// Patching of ELF entries inside of ZIP archives (Python wheels, JARs)
+// driven by the central directory. Entries that are not ELF are never
+// decompressed, they are copied verbatim with their compressed bytes.
+//
+// Stored ELF entries keep their size: the edits and the updated CRC-32
+// are written in place and the archive is not rewritten at all. Deflated
+// ELF entries are inflated, patched and deflated again, which changes
+// their compressed size, so the archive is then written aside with the
+// untouched byte ranges copied by the kernel, and renamed over.
+//
+// The *.dist-info/RECORD of a wheel gets the new sha256 and size of the
+// patched entries. Signed JARs and wheels are patched with a warning,
+// their signatures no longer match.
+//
+// Multi disk and ZIP64 archives are not supported.
+class Zip {
+public:
+    struct Stats {
+        size_t entries = 0;
+        size_t elf = 0;
+        size_t changed = 0;
+        size_t failed = 0;
+    };
+
+    // Archives given by Args::filenames one after the other, ELF entries
+    // of each archive are patched in parallel.
+    static int run(const Args& args);
+
+    // Entries failing to patch are kept unchanged and make the result non
+    // zero, malformed archives are left alone with -1.
+    static int patch(const std::string& path, const Args& args, std::ostream& out = std::cout,
+                     std::ostream& err = std::cerr, Stats* stats = nullptr);
+
+    // CRC-32 of content of size bytes with crc after [offset, offset + len)
+    // changed from old_bytes to new_bytes. Costs O(len + log size) instead
+    // of rehashing the content.
+    static uint32_t crc32_update(uint32_t crc, uint64_t size, uint64_t offset,
+                                 const char* old_bytes, const char* new_bytes, size_t len);
+};
@@ -36,6 +36,11 @@ template<> struct ElfClassTraits<Elf32> {
     using Phdr      = Elf32_Phdr;
     using Shdr      = Elf32_Shdr;
     using Dyn       = Elf32_Dyn;
+    using Verneed   = Elf32_Verneed;
+    using Vernaux   = Elf32_Vernaux;
+    using Verdef    = Elf32_Verdef;
+    using Verdaux   = Elf32_Verdaux;
+    using Nhdr      = Elf32_Nhdr;
 
     using Half      = Elf32_Half;
     using Word      = Elf32_Word;
@@ -56,6 +61,11 @@ template<> struct ElfClassTraits<Elf64> {
     using Phdr      = Elf64_Phdr;
     using Shdr      = Elf64_Shdr;
     using Dyn       = Elf64_Dyn;
+    using Verneed   = Elf64_Verneed;
+    using Vernaux   = Elf64_Vernaux;
+    using Verdef    = Elf64_Verdef;
+    using Verdaux   = Elf64_Verdaux;
+    using Nhdr      = Elf64_Nhdr;
 
     using Half      = Elf64_Half;
     using Word      = Elf64_Word;
@@ -0,0 +1,99 @@
+#ifndef SAFE_PATCHELF_H
+#define SAFE_PATCHELF_H
+
+/*
+ * C interface of libsafe_patchelf, for in process patching from other
+ * languages and runtimes. Only the functions declared here are exported
+ * from the shared library, the C++ implementation stays hidden.
+ *
+ * A handle maps one file privately. Edits apply to that view at once, so
+ * queries see them, and reach the file only by safe_patchelf_commit().
+ * Handles are independent: different handles may be used from different
+ * threads at the same time, one handle from one thread at a time.
+ *
+ * Functions returning int return 0 on success and -1 on failure, the
+ * reasons are collected in the diagnostics of the handle.
+ *
+ * Built by "make library": libsafe_patchelf.a (link C programs with
+ * -lstdc++ too) and libsafe_patchelf.so.1.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SAFE_PATCHELF_API __attribute__((visibility("default")))
+
+/* Version of this interface, bumped on incompatible changes only */
+#define SAFE_PATCHELF_ABI_VERSION 1
+
+typedef struct safe_patchelf safe_patchelf_t;
+
+typedef struct safe_patchelf_range {
+    size_t offset;
+    size_t length;
+} safe_patchelf_range_t;
+
+SAFE_PATCHELF_API int safe_patchelf_abi_version(void);
+
+/* NULL when the file can't be opened or is not a well formed ELF file,
+ * safe_patchelf_last_error() tells why. */
+SAFE_PATCHELF_API safe_patchelf_t* safe_patchelf_open(const char* path);
+
+/* Handle over size bytes of caller owned memory, which must stay valid
+ * and writable until close. Edits are made in that memory directly,
+ * nothing touches the file system and commit does nothing. NULL when the
+ * image does not fit into size bytes, safe_patchelf_last_error() tells
+ * why. String and version table offsets read from the image are checked
+ * against their sections by every query and edit. */
+SAFE_PATCHELF_API safe_patchelf_t* safe_patchelf_open_memory(void* data, size_t size);
+
+/* Drops edits which were not committed */
+SAFE_PATCHELF_API void safe_patchelf_close(safe_patchelf_t* handle);
+
+/* Reason of the last failed open of the calling thread, or of the last
+ * call refused for a NULL handle or aborted by an internal failure such
+ * as running out of memory. Those calls return NULL, 0 or -1; ones with
+ * a handle add the reason to its diagnostics as well. */
+SAFE_PATCHELF_API const char* safe_patchelf_last_error(void);
+
+/* Dynamic summary of the current view. Strings are owned by the handle
+ * and stay valid until the next edit or close; NULL when not present. */
+SAFE_PATCHELF_API int safe_patchelf_elf_class(safe_patchelf_t* handle);        /* 32 or 64 */
+SAFE_PATCHELF_API unsigned safe_patchelf_machine(safe_patchelf_t* handle);     /* e_machine */
+SAFE_PATCHELF_API const char* safe_patchelf_soname(safe_patchelf_t* handle);
+SAFE_PATCHELF_API const char* safe_patchelf_interpreter(safe_patchelf_t* handle);
+SAFE_PATCHELF_API const char* safe_patchelf_rpath(safe_patchelf_t* handle);
+SAFE_PATCHELF_API const char* safe_patchelf_runpath(safe_patchelf_t* handle);
+SAFE_PATCHELF_API size_t safe_patchelf_needed_count(safe_patchelf_t* handle);
+SAFE_PATCHELF_API const char* safe_patchelf_needed(safe_patchelf_t* handle, size_t index);
+
+/* Edits, none of them changes the size of the file. A failed edit leaves
+ * the content as it was before it. */
+SAFE_PATCHELF_API int safe_patchelf_set_soname(safe_patchelf_t* handle, const char* soname);
+SAFE_PATCHELF_API int safe_patchelf_replace_needed(safe_patchelf_t* handle, const char* old_needed, const char* new_needed);
+/* All count replacements in one pass, like -n given count times: succeeds
+ * when at least one of the old names is needed and all found ones fit */
+SAFE_PATCHELF_API int safe_patchelf_replace_neededs(safe_patchelf_t* handle, const char* const* old_neededs,
+                                                    const char* const* new_neededs, size_t count);
+SAFE_PATCHELF_API int safe_patchelf_set_interpreter(safe_patchelf_t* handle, const char* interpreter);
+SAFE_PATCHELF_API int safe_patchelf_update_build_id(safe_patchelf_t* handle);
+
+/* Writes the modified ranges to the file, a no-op without edits */
+SAFE_PATCHELF_API int safe_patchelf_commit(safe_patchelf_t* handle);
+
+/* Sorted, merged ranges changed by all edits since open. The array is
+ * owned by the handle and stays valid until the next edit or close. */
+SAFE_PATCHELF_API const safe_patchelf_range_t* safe_patchelf_modified(safe_patchelf_t* handle, size_t* count);
+
+/* Messages of all operations since open, one per line, errors start
+ * with "error: " */
+SAFE_PATCHELF_API const char* safe_patchelf_diagnostics(safe_patchelf_t* handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,389 @@
+#include <safe_patchelf/safe_patchelf.h>
+#include <safe_patchelf/Dispatch.h>
+#include <safe_patchelf/Summary.h>
+#include <safe_patchelf/FD.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <new>
+#include <exception>
+#include <algorithm>
+
+using Ranges = std::vector<std::pair<size_t, size_t> >;
+
+struct safe_patchelf {
+    std::string path;                       // empty for caller memory
+    FD fd;
+    caddr_t content = nullptr;
+    size_t size = 0;
+    std::pair<ElfClass, Endian> el_class;
+
+    Ranges ranges;                          // not committed yet
+    Ranges modified;                        // since open
+    std::vector<safe_patchelf_range_t> merged;
+    std::string diagnostics;
+
+    std::optional<ElfSummary> summary;      // of the current view
+};
+
+namespace {
+
+thread_local std::string last_error;
+
+// Sections edits may write to before they fail
+const char* const EDITED_SECTIONS[] = {".dynstr", ".gnu.version_r", ".gnu.version_d"};
+
+// Runs fn over the view, collects its messages and modified ranges. A
+// failed edit gets the bytes it wrote so far restored.
+struct DoApply {
+    template<class E, class Fn>
+    static bool entry(E& elf, caddr_t content, Fn& fn, std::string& diagnostics, Ranges& ranges) {
+        std::vector<std::pair<size_t, std::string> > saved;
+        std::for_each(std::begin(EDITED_SECTIONS), std::end(EDITED_SECTIONS), [&](auto name) {
+            if (auto range = elf.section_range(name))
+                saved.emplace_back(range->first, std::string(content + range->first, range->second));
+        });
+
+        // Restored below like any failed edit, then passed on
+        bool success = false;
+        std::exception_ptr failure;
+        try {
+            success = fn(elf);
+        } catch (...) {
+            failure = std::current_exception();
+        }
+
+        std::for_each(elf.results().begin(), elf.results().end(), [&](auto& it) {
+            diagnostics += it.second;
+            diagnostics += '\n';
+        });
+
+        auto modified = elf.modified_ranges();
+        if (!success) {
+            modified.erase(std::remove_if(modified.begin(), modified.end(), [&](auto& r) {
+                auto it = std::find_if(saved.begin(), saved.end(), [&r](auto& s) {
+                    return s.first <= r.first && r.first + r.second <= s.first + s.second.size();
+                });
+                if (it == saved.end())
+                    return false;
+                ::memcpy(content + r.first, it->second.data() + (r.first - it->first), r.second);
+                return true;
+            }), modified.end());
+        }
+        ranges.insert(ranges.end(), modified.begin(), modified.end());
+
+        if (failure)
+            std::rethrow_exception(failure);
+        return success;
+    }
+};
+
+template<class Fn>
+int apply(safe_patchelf* h, Fn fn) {
+    h->summary.reset();
+
+    Ranges ranges;
+    int ret = (h->el_class.first == Elf32)
+        ? class_entry<Elf32, DoApply>(h->content, h->el_class.second, h->content, fn, h->diagnostics, ranges)
+        : class_entry<Elf64, DoApply>(h->content, h->el_class.second, h->content, fn, h->diagnostics, ranges);
+
+    if (!h->path.empty())
+        h->ranges.insert(h->ranges.end(), ranges.begin(), ranges.end());
+    h->modified.insert(h->modified.end(), ranges.begin(), ranges.end());
+
+    return ret;
+}
+
+// Elf<> trusts offsets inside of the content, check all of them once
+bool check(safe_patchelf* h, const std::string& name) {
+    h->el_class = (h->size >= EI_NIDENT) ? elf_class(h->content) : std::make_pair(None, Unknown);
+    if (h->el_class.first == None || !elf_extent(h->content, h->size, h->el_class)) {
+        last_error = "error: " + name + ": Not an ELF file or broken ELF headers!";
+        return false;
+    }
+    return true;
+}
+
+const ElfSummary& summary(safe_patchelf* h) {
+    if (!h->summary) {
+        size_t size = h->size;
+        apply(h, [&](auto& elf) {
+            auto s = elf.summary(size);
+            h->summary = std::move(s);
+            return true;
+        });
+    }
+    return *h->summary;
+}
+
+// Assigning may throw itself, the message is dropped then
+void set_last_error(const char* message) noexcept {
+    try {
+        last_error = message;
+    } catch (...) {
+        last_error.clear();
+    }
+}
+
+// Nothing may unwind into C callers: exceptions become the fallback
+// result, with the reason in last_error and the handle's diagnostics.
+// A missing handle is refused the same way.
+template<class T, class Fn>
+T guarded(safe_patchelf* h, T fallback, Fn fn) noexcept {
+    const char* message = "error: No handle!";
+    if (h) {
+        try {
+            return fn();
+        } catch (const std::bad_alloc&) {
+            message = "error: Out of memory!";
+        } catch (...) {
+            message = "error: Unexpected failure!";
+        }
+    }
+
+    set_last_error(message);
+    try {
+        if (h)
+            h->diagnostics += std::string(message) + "\n";
+    } catch (...) {
+    }
+    return fallback;
+}
+
+// Refused arguments of an edit, reported like its other errors
+int refuse(safe_patchelf* h, const char* message) {
+    h->diagnostics += std::string("error: ") + message + "\n";
+    return -1;
+}
+
+const char* c_str(const std::optional<std::string>& s) {
+    return s ? s->c_str() : nullptr;
+}
+
+bool pwrite_full(int fd, const void* buf, size_t len, size_t offset) {
+    auto p = reinterpret_cast<const char*>(buf);
+    while (len) {
+        ssize_t n = ::pwrite(fd, p, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Private view of the file: edits stay in memory until commit
+bool open_file(safe_patchelf* h, const char* path) {
+    h->path = path;
+    h->fd = FD(::open(path, O_RDONLY | O_CLOEXEC));
+    if (h->fd.bad()) {
+        last_error = std::string("error: Can't open ") + path + "!";
+        return false;
+    }
+
+    h->size = h->fd.size();
+    h->content = (h->size >= EI_NIDENT)
+        ? reinterpret_cast<caddr_t>(h->fd.mmap(0, 0, PROT_READ | PROT_WRITE, MAP_FILE | MAP_PRIVATE))
+        : nullptr;
+    if (!h->content) {
+        last_error = std::string("error: ") + path + ": Not an ELF file!";
+        return false;
+    }
+
+    return check(h, path);
+}
+
+} // namespace
+
+extern "C" {
+
+int safe_patchelf_abi_version(void) {
+    return SAFE_PATCHELF_ABI_VERSION;
+}
+
+safe_patchelf_t* safe_patchelf_open(const char* path) {
+    auto h = new (std::nothrow) safe_patchelf;
+    if (!h) {
+        set_last_error("error: Out of memory!");
+        return nullptr;
+    }
+
+    auto opened = guarded(h, (safe_patchelf_t*)nullptr, [&]() -> safe_patchelf_t* {
+        if (!path) {
+            last_error = "error: No path!";
+            return nullptr;
+        }
+        return open_file(h, path) ? h : nullptr;
+    });
+    if (!opened)
+        delete h;
+    return opened;
+}
+
+safe_patchelf_t* safe_patchelf_open_memory(void* data, size_t size) {
+    auto h = new (std::nothrow) safe_patchelf;
+    if (!h) {
+        set_last_error("error: Out of memory!");
+        return nullptr;
+    }
+
+    auto opened = guarded(h, (safe_patchelf_t*)nullptr, [&]() -> safe_patchelf_t* {
+        h->content = reinterpret_cast<caddr_t>(data);
+        h->size = size;
+        if (!data) {
+            last_error = "error: memory: No content!";
+            return nullptr;
+        }
+        return check(h, "memory") ? h : nullptr;
+    });
+    if (!opened)
+        delete h;
+    return opened;
+}
+
+void safe_patchelf_close(safe_patchelf_t* handle) {
+    delete handle;
+}
+
+const char* safe_patchelf_last_error(void) {
+    return last_error.c_str();
+}
+
+int safe_patchelf_elf_class(safe_patchelf_t* handle) {
+    return guarded(handle, 0, [&] { return (handle->el_class.first == Elf32) ? 32 : 64; });
+}
+
+unsigned safe_patchelf_machine(safe_patchelf_t* handle) {
+    return guarded(handle, 0u, [&] { return unsigned(summary(handle).machine); });
+}
+
+const char* safe_patchelf_soname(safe_patchelf_t* handle) {
+    return guarded(handle, (const char*)nullptr, [&] { return c_str(summary(handle).soname); });
+}
+
+const char* safe_patchelf_interpreter(safe_patchelf_t* handle) {
+    return guarded(handle, (const char*)nullptr, [&] { return c_str(summary(handle).interp); });
+}
+
+const char* safe_patchelf_rpath(safe_patchelf_t* handle) {
+    return guarded(handle, (const char*)nullptr, [&] { return c_str(summary(handle).rpath); });
+}
+
+const char* safe_patchelf_runpath(safe_patchelf_t* handle) {
+    return guarded(handle, (const char*)nullptr, [&] { return c_str(summary(handle).runpath); });
+}
+
+size_t safe_patchelf_needed_count(safe_patchelf_t* handle) {
+    return guarded(handle, size_t(0), [&] { return summary(handle).needed.size(); });
+}
+
+const char* safe_patchelf_needed(safe_patchelf_t* handle, size_t index) {
+    return guarded(handle, (const char*)nullptr, [&]() -> const char* {
+        auto& needed = summary(handle).needed;
+        return (index < needed.size()) ? needed[index].c_str() : nullptr;
+    });
+}
+
+int safe_patchelf_set_soname(safe_patchelf_t* handle, const char* soname) {
+    return guarded(handle, -1, [&] {
+        if (!soname)
+            return refuse(handle, "No soname!");
+        return apply(handle, [soname](auto& elf) { return elf.set_soname(soname); });
+    });
+}
+
+int safe_patchelf_replace_needed(safe_patchelf_t* handle, const char* old_needed, const char* new_needed) {
+    return safe_patchelf_replace_neededs(handle, &old_needed, &new_needed, 1);
+}
+
+int safe_patchelf_replace_neededs(safe_patchelf_t* handle, const char* const* old_neededs,
+                                  const char* const* new_neededs, size_t count) {
+    return guarded(handle, -1, [&] {
+        if (count && (!old_neededs || !new_neededs))
+            return refuse(handle, "No needed names!");
+
+        std::map<std::string, std::string> replacements;
+        for (size_t i = 0; i < count; ++i) {
+            if (!old_neededs[i] || !new_neededs[i])
+                return refuse(handle, "No needed names!");
+            replacements[old_neededs[i]] = new_neededs[i];
+        }
+        return apply(handle, [&replacements](auto& elf) { return elf.update_neededs(replacements); });
+    });
+}
+
+int safe_patchelf_set_interpreter(safe_patchelf_t* handle, const char* interpreter) {
+    return guarded(handle, -1, [&] {
+        if (!interpreter)
+            return refuse(handle, "No interpreter!");
+        return apply(handle, [interpreter](auto& elf) { return elf.set_interpreter(interpreter); });
+    });
+}
+
+int safe_patchelf_update_build_id(safe_patchelf_t* handle) {
+    return guarded(handle, -1, [&] {
+        size_t size = handle->size;
+        return apply(handle, [size](auto& elf) { return elf.update_build_id(size); });
+    });
+}
+
+int safe_patchelf_commit(safe_patchelf_t* handle) {
+    return guarded(handle, -1, [&] {
+        if (handle->ranges.empty())
+            return 0;
+
+        FD fd(::open(handle->path.c_str(), O_WRONLY | O_CLOEXEC));
+        if (fd.bad() || fd.size() != handle->size) {
+            handle->diagnostics += "error: Can't open " + handle->path + " for writing!\n";
+            return -1;
+        }
+
+        bool ok = std::all_of(handle->ranges.begin(), handle->ranges.end(), [&](auto& r) {
+            return pwrite_full(fd.get(), handle->content + r.first, r.second, r.first);
+        });
+        if (!ok) {
+            handle->diagnostics += "error: Can't write " + handle->path + "!\n";
+            return -1;
+        }
+
+        handle->ranges.clear();
+        return 0;
+    });
+}
+
+const safe_patchelf_range_t* safe_patchelf_modified(safe_patchelf_t* handle, size_t* count) {
+    if (count)
+        *count = 0;
+
+    return guarded(handle, (const safe_patchelf_range_t*)nullptr, [&] {
+        Ranges ranges(handle->modified);
+        std::sort(ranges.begin(), ranges.end());
+
+        handle->merged.clear();
+        std::for_each(ranges.begin(), ranges.end(), [handle](auto& r) {
+            auto& merged = handle->merged;
+            if (!merged.empty() && r.first <= merged.back().offset + merged.back().length)
+                merged.back().length = std::max(merged.back().length, r.first + r.second - merged.back().offset);
+            else
+                merged.push_back(safe_patchelf_range_t{r.first, r.second});
+        });
+
+        if (count)
+            *count = handle->merged.size();
+        return (const safe_patchelf_range_t*)handle->merged.data();
+    });
+}
+
+const char* safe_patchelf_diagnostics(safe_patchelf_t* handle) {
+    return handle ? handle->diagnostics.c_str() : "";
+}
+
+} // extern "C"
@@ -1,7 +1,10 @@
 #include <safe_patchelf/Args.h>
+#include <safe_patchelf/Hash.h>
 
 #include <algorithm>
 
+#include <cstdlib>
+
 #include <getopt.h>
 
 /*static*/ std::optional<std::pair<std::string, std::string> > Args::parse_needed(const char* n) {
@@ -11,7 +14,7 @@
        return std::nullopt;
 
     std::string old_needed(s.c_str(), it);
-    std::string new_needed(s.c_str() + it + 1, s.size() - it);
+    std::string new_needed(s.c_str() + it + 1, s.size() - it - 1);
 
     if (old_needed.empty() || new_needed.empty())
        return std::nullopt;
@@ -21,33 +24,114 @@
 
 void Args::print(std::ostream& out) const {
     out << "Arguments:" << std::endl;
-    if (!filename.empty())
-        out << "\tinput file: " << filename << std::endl;
+    std::for_each(filenames.begin(), filenames.end(), [&](auto& f) {
+        out << "\tinput file: " << f << std::endl;
+    });
     if (!soname.empty())
         out << "\tnew soname: " << soname << std::endl;
+    if (!interpreter.empty())
+        out << "\tnew interpreter: " << interpreter << std::endl;
     std::for_each(neededs.begin(), neededs.end(), [&](auto& n) {
         out << "\tnew needed: " << n.first << " -> " << n.second << std::endl;
     });
+    if (update_build_id)
+        out << "\tupdate build-id" << std::endl;
+    if (digest)
+        out << "\temit sha256 digest" << std::endl;
+    if (!cache.empty())
+        out << "\tscan cache: " << cache << std::endl;
+    if (dedup)
+        out << "\tpatch identical files once" << std::endl;
+    if (!journal.empty())
+        out << "\tjournal: " << journal << std::endl;
+    if (!record_plan.empty())
+        out << "\trecord plan: " << record_plan << std::endl;
+    if (!replay_plan.empty())
+        out << "\treplay plan: " << replay_plan << std::endl;
+    if (!index.empty())
+        out << "\tneeded index: " << index << std::endl;
+    if (verify_versions)
+        out << "\tverify symbol versions of new needed" << std::endl;
+    std::for_each(library_path.begin(), library_path.end(), [&](auto& l) {
+        out << "\tlibrary path: " << l << std::endl;
+    });
+    if (zip)
+        out << "\tpatch ELF entries of ZIP archives" << std::endl;
+    if (cpio)
+        out << "\tpatch ELF members of cpio archives in place" << std::endl;
+    if (oci)
+        out << "\tpatch layers of OCI image layouts" << std::endl;
+    if (blob)
+        out << "\tpatch ELF images embedded in blobs" << std::endl;
 }
 
 /*static*/ void Args::show_usage(const char *program_name, std::ostream& out) {
-    out << "Usage: " << program_name << " <options>"                                  << std::endl;
+    out << "Usage: " << program_name << " <options> [<file or directory>...]"         << std::endl;
     out << "Were options are:"                                                        << std::endl;
-    out << "\t-f,--filename: File to process."                                        << std::endl;
+    out << "\t-f,--filename: File or directory to process, may be repeated; '-' alone"
+                                       " patches stdin to stdout." << std::endl;
     out << "\t-s,--soname  : New ELF soname."                                         << std::endl;
     out << "\t-n,--needed  : New ELF needed in format: <old needed>,<new needed>."    << std::endl;
+    out << "\t-i,--interpreter: New ELF interpreter (PT_INTERP)."                     << std::endl;
+    out << "\t-b,--update-build-id: Recompute GNU build-id from patched content."      << std::endl;
+    out << "\t-d,--digest  : Emit NDJSON sha256 digest of the patched file."          << std::endl;
+    out << "\t-q,--query   : Read only, emit NDJSON dynamic summary of each ELF file."  << std::endl;
+    out << "\t-g,--graph   : Read only, resolve DT_NEEDED of all objects in the given"
+                                       " sysroot(s), report missing/ambiguous/cyclic ones." << std::endl;
+    out << "\t-j,--jobs    : Number of files processed in parallel."                  << std::endl;
+    out << "\t-c,--cache   : Persistent scan cache file, unchanged files are not reopened." << std::endl;
+    out << "\t-D,--dedup   : Patch byte identical inputs once, reflink or replay the others." << std::endl;
+    out << "\t-J,--journal: Incremental mode, skip files unchanged since the journaled run"
+                                       " unless a changed rule applies to them." << std::endl;
+    out << "\t-R,--record-plan: Record byte edits of patched files keyed by content hash." << std::endl;
+    out << "\t-P,--replay-plan: Apply recorded edits to identical inputs without ELF parsing,"
+                                       " other files are patched by the given options if any." << std::endl;
+    out << "\t-x,--index  : Reverse dependency index file. Updated over the given paths;"
+                                       " with -n patches exactly the indexed files needing the old names." << std::endl;
+    out << "\t-w,--who-needs: Emit NDJSON list of indexed files with the given DT_NEEDED." << std::endl;
+    out << "\t-V,--verify-versions: Before writing, check that new needed libraries define"
+                                       " all symbol versions required from the old ones." << std::endl;
+    out << "\t-L,--library-path: Directory searched first for new needed libraries, may be repeated." << std::endl;
+    out << "\t-t,--tar    : Patch ELF members of the tar archive read from stdin,"
+                                       " write the archive to stdout." << std::endl;
+    out << "\t-z,--zip    : Files are ZIP archives (wheels, JARs), patch their ELF entries." << std::endl;
+    out << "\t-C,--cpio   : Files are newc cpio archives (initramfs), patch their ELF members in place." << std::endl;
+    out << "\t-O,--oci    : Directories are OCI image layouts, patch their tar layers and"
+                                       " regenerate digests, configs and manifests." << std::endl;
+    out << "\t-B,--blob   : Files are raw blobs (firmware bundles), patch the ELF images found"
+                                       " inside in place." << std::endl;
     out << "\t-h,-?        : Show this help message."                                 << std::endl;
 }
 
 /*static*/ std::optional<Args> Args::parse_args(int argc, char** argv) {
     Args args;
 
-    static const char *opt_string = "f:s:n:h?";
+    static const char *opt_string = "f:s:n:i:bdqgj:c:DJ:R:P:x:w:VL:tzCOBh?";
 
     static const struct option long_opts[] = {
         { "filename",   required_argument,  NULL, 'f' },
         { "soname",     required_argument,  NULL, 's' },
         { "needed",     required_argument,  NULL, 'n' },
+        { "interpreter",required_argument,  NULL, 'i' },
+        { "update-build-id", no_argument,   NULL, 'b' },
+        { "digest",     no_argument,        NULL, 'd' },
+        { "query",      no_argument,        NULL, 'q' },
+        { "jobs",       required_argument,  NULL, 'j' },
+        { "graph",      no_argument,        NULL, 'g' },
+        { "cache",      required_argument,  NULL, 'c' },
+        { "dedup",      no_argument,        NULL, 'D' },
+        { "journal",    required_argument,  NULL, 'J' },
+        { "record-plan",required_argument,  NULL, 'R' },
+        { "replay-plan",required_argument,  NULL, 'P' },
+        { "index",      required_argument,  NULL, 'x' },
+        { "who-needs",  required_argument,  NULL, 'w' },
+        { "verify-versions", no_argument,   NULL, 'V' },
+        { "library-path",required_argument, NULL, 'L' },
+        { "tar",        no_argument,        NULL, 't' },
+        { "zip",        no_argument,        NULL, 'z' },
+        { "cpio",       no_argument,        NULL, 'C' },
+        { "oci",        no_argument,        NULL, 'O' },
+        { "blob",       no_argument,        NULL, 'B' },
         { NULL,         no_argument,        NULL, 0 }
     };
 
@@ -61,7 +145,7 @@ void Args::print(std::ostream& out) const {
             break;
 
         if (opt == 'f' || (opt == 0 && long_index == 0)) {
-            args.filename = optarg;
+            args.filenames.push_back(optarg);
         } else if (opt == 's' || (opt == 0 && long_index == 1)) {
             args.soname = optarg;
         } else if (opt == 'n' || (opt == 0 && long_index == 2)) {
@@ -71,6 +155,51 @@ void Args::print(std::ostream& out) const {
                 return std::nullopt;
             }
             args.neededs.insert(*n);
+        } else if (opt == 'i' || (opt == 0 && long_index == 3)) {
+            args.interpreter = optarg;
+        } else if (opt == 'b' || (opt == 0 && long_index == 4)) {
+            args.update_build_id = true;
+        } else if (opt == 'd' || (opt == 0 && long_index == 5)) {
+            args.digest = true;
+        } else if (opt == 'q' || (opt == 0 && long_index == 6)) {
+            args.query = true;
+        } else if (opt == 'j' || (opt == 0 && long_index == 7)) {
+            char* end = nullptr;
+            args.jobs = ::strtoul(optarg, &end, 10);
+            if (!end || *end != '\0') {
+                std::cerr << "error: Wrong jobs option: " << optarg << std::endl;
+                return std::nullopt;
+            }
+        } else if (opt == 'g' || (opt == 0 && long_index == 8)) {
+            args.graph = true;
+        } else if (opt == 'c' || (opt == 0 && long_index == 9)) {
+            args.cache = optarg;
+        } else if (opt == 'D' || (opt == 0 && long_index == 10)) {
+            args.dedup = true;
+        } else if (opt == 'J' || (opt == 0 && long_index == 11)) {
+            args.journal = optarg;
+        } else if (opt == 'R' || (opt == 0 && long_index == 12)) {
+            args.record_plan = optarg;
+        } else if (opt == 'P' || (opt == 0 && long_index == 13)) {
+            args.replay_plan = optarg;
+        } else if (opt == 'x' || (opt == 0 && long_index == 14)) {
+            args.index = optarg;
+        } else if (opt == 'w' || (opt == 0 && long_index == 15)) {
+            args.who_needs = optarg;
+        } else if (opt == 'V' || (opt == 0 && long_index == 16)) {
+            args.verify_versions = true;
+        } else if (opt == 'L' || (opt == 0 && long_index == 17)) {
+            args.library_path.push_back(optarg);
+        } else if (opt == 't' || (opt == 0 && long_index == 18)) {
+            args.tar = true;
+        } else if (opt == 'z' || (opt == 0 && long_index == 19)) {
+            args.zip = true;
+        } else if (opt == 'C' || (opt == 0 && long_index == 20)) {
+            args.cpio = true;
+        } else if (opt == 'O' || (opt == 0 && long_index == 21)) {
+            args.oci = true;
+        } else if (opt == 'B' || (opt == 0 && long_index == 22)) {
+            args.blob = true;
         //} else if (opt == 'h' || opt == '?') {
         //    show_usage(argv[0]);
         //    return std::nullopt;
@@ -81,7 +210,44 @@ void Args::print(std::ostream& out) const {
 
     } while (true);
 
-    if (args.filename.empty()) {
+    for (int i = optind; i < argc; ++i)
+        args.filenames.push_back(argv[i]);
+
+    if (!args.who_needs.empty() && args.index.empty()) {
+        std::cerr << "error: --who-needs requires --index!" << std::endl;
+        return std::nullopt;
+    }
+
+    if (args.tar && !args.filenames.empty()) {
+        std::cerr << "error: --tar reads the archive from stdin, no files expected!" << std::endl;
+        return std::nullopt;
+    }
+
+    bool archive = args.zip || args.cpio || args.oci || args.blob;
+    if (int(args.tar) + int(args.zip) + int(args.cpio) + int(args.oci) + int(args.blob) > 1
+        || (archive && !args.index.empty())) {
+        std::cerr << "error: Only one of --tar, --zip, --cpio, --oci and --blob, and none with --index!" << std::endl;
+        return std::nullopt;
+    }
+
+    bool dash = std::find(args.filenames.begin(), args.filenames.end(), "-") != args.filenames.end();
+    if (dash && (!args.stdio() || archive || !args.index.empty())) {
+        std::cerr << "error: '-' must be the only file, without archive and index options!" << std::endl;
+        return std::nullopt;
+    }
+
+    // Streams and archive members are patched in memory one by one, none
+    // of the per file options applies to them
+    if ((dash || archive || args.tar)
+        && (args.verify_versions || args.digest || args.dedup || !args.journal.empty() || !args.cache.empty()
+            || !args.record_plan.empty() || !args.replay_plan.empty())) {
+        std::cerr << "error: '-' and archives don't support --verify-versions, --digest, --dedup, --journal, --cache"
+                  << " and plan options!" << std::endl;
+        return std::nullopt;
+    }
+
+    // Index lookups and index driven renames need no paths
+    if (args.filenames.empty() && args.index.empty() && !args.tar) {
         std::cerr << "error: No file to process!" << std::endl;
         show_usage(argv[0]);
         return std::nullopt;
@@ -90,9 +256,37 @@ void Args::print(std::ostream& out) const {
     return args;
 }
 
+bool Args::stdio() const {
+    return filenames.size() == 1 && filenames.front() == "-" && !query && !graph;
+}
+
 bool Args::have_work() const {
-    if (soname.empty() && neededs.empty())
+    if (query || graph || !replay_plan.empty())
+        return true;
+
+    if (soname.empty() && neededs.empty() && interpreter.empty() && !update_build_id)
         return false;
 
     return true;
 }
+
+uint64_t Args::fingerprint() const {
+    if (soname.empty() && neededs.empty() && interpreter.empty() && !update_build_id)
+        return 0;
+
+    Xxh64 hash;
+    auto put = [&hash](const std::string& s) { hash.update(s.c_str(), s.size() + 1); };
+
+    put("soname");
+    put(soname);
+    put("interpreter");
+    put(interpreter);
+    put("neededs");
+    std::for_each(neededs.begin(), neededs.end(), [&](auto& n) {
+        put(n.first);
+        put(n.second);
+    });
+    put(update_build_id ? "update-build-id" : "");
+
+    return hash.digest() | 1;
+}
@@ -0,0 +1,741 @@
+#include <safe_patchelf/Batch.h>
+#include <safe_patchelf/Dispatch.h>
+#include <safe_patchelf/Scheduler.h>
+#include <safe_patchelf/Query.h>
+#include <safe_patchelf/Journal.h>
+#include <safe_patchelf/Plan.h>
+#include <safe_patchelf/VersionCheck.h>
+#include <safe_patchelf/Hash.h>
+#include <safe_patchelf/Json.h>
+#include <safe_patchelf/FD.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+namespace {
+
+// Requested changes still to be made to one image. A rule that does not
+// apply to it (no DT_SONAME to rename, no PT_INTERP, none of the old
+// needed names, no build-id note) is left out, unless strict: explicitly
+// named files get the error for it.
+struct Pending {
+    bool soname      = false;
+    bool neededs     = false;
+    bool interpreter = false;
+    bool build_id    = false;
+
+    bool any() const { return soname || neededs || interpreter || build_id; }
+};
+
+struct DoElfPatching {
+    template<class E>
+    static bool entry(E& elf, const Args& args, const Pending& pending, size_t size, const std::string& prefix,
+                      std::ostream& out, std::ostream& err, typename E::Ranges& modified) {
+        bool success = true;
+
+        if (pending.soname)
+            success &= elf.set_soname(args.soname.c_str());
+
+        if (pending.neededs)
+            success &= elf.update_neededs(args.neededs);
+
+        if (pending.interpreter)
+            success &= elf.set_interpreter(args.interpreter.c_str());
+
+        // Last one, hashes the final content
+        if (pending.build_id && success)
+            success &= elf.update_build_id(size);
+
+        if (!elf.results().empty()) {
+            std::for_each(elf.results().begin(), elf.results().end(), [&](auto& it) {
+                if (it.first)
+                    err << prefix << it.second << std::endl;
+                else
+                    out << prefix << it.second << std::endl;
+            });
+        }
+
+        modified = elf.modified_ranges();
+
+        return success;
+    }
+};
+
+// Read only: finds what is left to do, nothing when the file is already
+// in the requested state, so a rerun over a patched tree does not need to
+// open anything for writing.
+struct DoElfCheck {
+    template<class E>
+    static bool entry(E& elf, const Args& args, size_t size, bool strict, Pending& pending) {
+        auto summary = elf.summary(size);
+
+        // Executables have no soname to set
+        if (!args.soname.empty()) {
+            bool applies = summary.soname && !summary.interp;
+            pending.soname = applies ? (*summary.soname != args.soname) : strict;
+        }
+
+        if (!args.interpreter.empty())
+            pending.interpreter = summary.interp ? (*summary.interp != args.interpreter) : strict;
+
+        // Old name left; a file needing neither the old nor the new names
+        // is not affected by the rule
+        if (!args.neededs.empty()) {
+            bool applies = false;
+            pending.neededs = std::any_of(summary.needed.begin(), summary.needed.end(), [&](auto& needed) {
+                auto it = args.neededs.find(needed);
+                applies |= it != args.neededs.end()
+                    || std::any_of(args.neededs.begin(), args.neededs.end(), [&](auto& n) { return n.second == needed; });
+                return it != args.neededs.end() && it->second != needed;
+            });
+            pending.neededs |= strict && !applies;
+        }
+
+        // Whole file hash, last and only when nothing else changes it
+        if (args.update_build_id) {
+            bool applies = bool(elf.section_range(".note.gnu.build-id"));
+            pending.build_id = applies ? (pending.any() || !elf.build_id_matches(size)) : strict;
+        }
+
+        return true;
+    }
+};
+
+// Hash of the first page (ELF and program headers) plus .dynamic and
+// .dynstr, enough to tell apart most different objects of the same size.
+struct DoElfQuickHash {
+    template<class E>
+    static bool entry(E& elf, caddr_t content, size_t size, uint64_t& result) {
+        Xxh64 hash;
+        hash.update(content, std::min<size_t>(size, 4096));
+
+        const char* sections[] = {".dynamic", ".dynstr"};
+        std::for_each(std::begin(sections), std::end(sections), [&](auto name) {
+            auto range = elf.section_range(name);
+            if (range && range->first <= size && range->second <= size - range->first)
+                hash.update(content + range->first, range->second);
+        });
+
+        result = hash.digest();
+        return true;
+    }
+};
+
+// Digest of the patched content, computed from the same mapping while
+// its pages are still hot instead of re-reading the file afterwards.
+std::string content_digest(caddr_t content, size_t size) {
+    Sha256 sha;
+    sha.update(content, size);
+    return sha.hex_digest();
+}
+
+void emit_digest(const std::string& filename, size_t size, const std::string& sha256, std::ostream& out) {
+    out << "{\"file\":";
+    Json::quoted(out, filename);
+    out << ",\"size\":" << size
+        << ",\"sha256\":\"" << sha256 << "\"}" << std::endl;
+}
+
+// Maps file read only, sets content/size. Returns false for non ELF or
+// broken files.
+bool map_elf(FD& fd, const std::string& path, caddr_t& content, size_t& size) {
+    fd = FD(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.bad())
+        return false;
+
+    char ident[EI_NIDENT];
+    if (::pread(fd.get(), ident, sizeof(ident), 0) != sizeof(ident) || elf_class(ident).first == None)
+        return false;
+
+    size    = fd.size();
+    content = reinterpret_cast<caddr_t>(fd.mmap(0, 0, PROT_READ, MAP_FILE | MAP_PRIVATE));
+
+    return content && elf_headers_fit(content, size, elf_class(content));
+}
+
+} // namespace
+
+/*static*/ int Batch::patch_buffer(caddr_t content, size_t size, const Args& args, const std::string& prefix,
+                                    std::ostream& out, std::ostream& err, bool* changed, Ranges* ranges, bool strict) {
+    if (changed)
+        *changed = false;
+    if (ranges)
+        ranges->clear();
+
+    // Nothing but the content: all tables, segments and sections must lie
+    // inside of size bytes before Elf<> is let at it
+    auto el_class = (size >= EI_NIDENT) ? elf_class(content) : std::make_pair(None, Unknown);
+    if (!elf_extent(content, size, el_class)) {
+        err << prefix << "error: Broken ELF headers!" << std::endl;
+        return -1;
+    }
+
+    Pending pending;
+    if (el_class.first == Elf32)
+        class_entry<Elf32, DoElfCheck>(content, el_class.second, args, size, strict, pending);
+    else
+        class_entry<Elf64, DoElfCheck>(content, el_class.second, args, size, strict, pending);
+    if (!pending.any())
+        return 0;
+
+    Ranges modified;
+    int ret = (el_class.first == Elf32)
+        ? class_entry<Elf32, DoElfPatching>(content, el_class.second, args, pending, size, prefix, out, err, modified)
+        : class_entry<Elf64, DoElfPatching>(content, el_class.second, args, pending, size, prefix, out, err, modified);
+
+    if (changed)
+        *changed = !modified.empty();
+    if (ranges)
+        *ranges = std::move(modified);
+
+    return ret;
+}
+
+/*static*/ Batch::Outcome Batch::patch_file(const Walker::Group& links, const Args& args, ScanCache* cache,
+                                            const std::string& prefix, std::ostream& out, std::ostream& err, Plan* plan,
+                                            VersionCheck* versions) {
+    Outcome outcome;
+
+    auto& entry = *links.front();
+    bool from_dir = std::all_of(links.begin(), links.end(), [](auto* e) { return e->from_dir; });
+
+    uint64_t rules = args.fingerprint();
+
+    // Unchanged since the last run: skip without opening. Digests are
+    // emitted for every ELF file, those have to be read anyway.
+    if (cache) {
+        auto record = cache->find(entry.st, &outcome.summary);
+        if ((record && record->kind == ScanCache::NotElf && from_dir)
+            || (record && record->kind == ScanCache::IsElf && record->rules == rules && !args.digest)) {
+            outcome.ret = 0;
+            return outcome;
+        }
+        outcome.summary.reset();
+    }
+
+    FD fd(::open(entry.path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.bad()) {
+        err << "error: Can't open " << entry.path << "!" << std::endl;
+        return outcome;
+    }
+
+    // Files found in directories are silently skipped when not ELF
+    char ident[EI_NIDENT];
+    if (::pread(fd.get(), ident, sizeof(ident), 0) != sizeof(ident) || elf_class(ident).first == None) {
+        if (cache)
+            cache->record_not_elf(entry.st);
+        if (from_dir) {
+            outcome.ret = 0;
+            return outcome;
+        }
+        err << "error: " << entry.path << " not an ELF file!" << std::endl;
+        return outcome;
+    }
+
+    size_t content_size = fd.size();
+    caddr_t content = reinterpret_cast<caddr_t>(fd.mmap(0, 0, PROT_READ, MAP_FILE | MAP_PRIVATE));
+    if (!content) {
+        err << "error: Can't map " << entry.path << "!" << std::endl;
+        return outcome;
+    }
+
+    // Build-id and digest read whole file, let read ahead overlap with the rest
+    if (args.update_build_id || args.digest)
+        fd.prefetch(content);
+
+    // Edits follow offsets inside of sections, those must fit as well
+    auto el_class = elf_class(content);
+    if (!elf_extent(content, content_size, el_class)) {
+        err << "error: " << entry.path << " has broken ELF headers!" << std::endl;
+        return outcome;
+    }
+
+    Pending pending;
+    if (el_class.first == Elf32)
+        class_entry<Elf32, DoElfCheck>(content, el_class.second, args, content_size, !from_dir, pending);
+    else
+        class_entry<Elf64, DoElfCheck>(content, el_class.second, args, content_size, !from_dir, pending);
+    bool done = !pending.any();
+
+    // Reported before anything is written
+    if (!done && versions && !args.neededs.empty()) {
+        auto problems = versions->check(content, content_size, entry.path, args.neededs);
+        if (!problems.empty()) {
+            std::for_each(problems.begin(), problems.end(), [&](auto& p) { err << prefix << "error: " << p << std::endl; });
+            return outcome;
+        }
+    }
+
+    // Recording a plan patches a private copy on write mapping: the original
+    // bytes stay readable from the read only one and edits go out by pwrite.
+    caddr_t original = content;
+    std::string in_sha256;
+    FD wfd;
+
+    // Already in the requested state: no write access, no dirty pages, mtime kept
+    if (!done) {
+        if (plan)
+            in_sha256 = Plan::sha256(content, content_size);
+
+        wfd = FD(::open(entry.path.c_str(), O_RDWR | O_CLOEXEC));
+        if (wfd.bad()) {
+            err << "error: Can't open " << entry.path << "!" << std::endl;
+            return outcome;
+        }
+
+        if (wfd.size() != content_size) {
+            err << "error: " << entry.path << " changed while patching!" << std::endl;
+            return outcome;
+        }
+
+        content = reinterpret_cast<caddr_t>(wfd.mmap(0, 0, PROT_READ|PROT_WRITE, MAP_FILE | (plan ? MAP_PRIVATE : MAP_SHARED)));
+        if (!content) {
+            err << "error: Can't map " << entry.path << "!" << std::endl;
+            return outcome;
+        }
+
+        el_class = elf_class(content);
+        if (!elf_extent(content, content_size, el_class)) {
+            err << "error: " << entry.path << " has broken ELF headers!" << std::endl;
+            return outcome;
+        }
+    }
+
+    std::vector<std::pair<size_t, size_t> > modified;
+
+    // Standard output is NDJSON with digests, warnings go with the errors
+    std::ostream& messages = args.digest ? err : out;
+
+    switch(done ? None : el_class.first) {
+    case None:
+    {
+        outcome.ret = 0;
+    }
+    break;
+    case Elf32:
+    {
+        outcome.ret = class_entry<Elf32, DoElfPatching>(content, el_class.second, args, pending, content_size, prefix, messages, err, modified);
+    }
+    break;
+    case Elf64:
+    {
+        outcome.ret = class_entry<Elf64, DoElfPatching>(content, el_class.second, args, pending, content_size, prefix, messages, err, modified);
+    }
+    break;
+    default:
+        err << "error: " << entry.path << " not an ELF file!" << std::endl;
+        return outcome;
+    };
+
+    outcome.patched = !done;
+
+    std::for_each(modified.begin(), modified.end(), [&](auto& r) {
+        outcome.edits.push_back(std::make_pair(r.first, std::string(content + r.first, r.second)));
+    });
+
+    if (plan && !done) {
+        Plan::Entry recorded;
+        recorded.in_sha256 = in_sha256;
+        recorded.size = content_size;
+        std::for_each(outcome.edits.begin(), outcome.edits.end(), [&](auto& e) {
+            recorded.edits.push_back({e.first, std::string(original + e.first, e.second.size()), e.second});
+        });
+
+        bool written = std::all_of(outcome.edits.begin(), outcome.edits.end(), [&](auto& e) {
+            return ::pwrite(wfd.get(), e.second.data(), e.second.size(), e.first) == ssize_t(e.second.size());
+        });
+        if (!written) {
+            err << "error: Can't write " << entry.path << "!" << std::endl;
+            outcome.ret = -1;
+        }
+
+        if (outcome.ret == 0) {
+            recorded.out_sha256 = Plan::sha256(content, content_size);
+            plan->add(std::move(recorded));
+        }
+    }
+
+    if (outcome.ret == 0 && args.digest) {
+        outcome.sha256 = content_digest(content, content_size);
+        std::for_each(links.begin(), links.end(), [&](auto* link) {
+            emit_digest(link->path, content_size, outcome.sha256, out);
+        });
+    }
+
+    if (outcome.ret == 0 && (cache || !args.journal.empty()))
+        outcome.summary = Query::summarize(content, content_size);
+
+    // Remember the new identity as matching the rules
+    if (outcome.ret == 0 && cache)
+        cache->record_elf(done ? fd.stat() : wfd.stat(), *outcome.summary, rules);
+
+    return outcome;
+}
+
+/*static*/ std::vector<std::vector<size_t> > Batch::identical_contents(const std::vector<Walker::Group>& groups,
+                                                                      const std::vector<bool>& candidates, unsigned jobs) {
+    using Bucket = std::vector<size_t>;
+
+    // Refines every bucket with more than one member by the given key
+    auto refine = [jobs, &groups](const std::vector<Bucket>& buckets, auto key_of) {
+        Bucket flat;
+        std::for_each(buckets.begin(), buckets.end(), [&](auto& b) { flat.insert(flat.end(), b.begin(), b.end()); });
+
+        std::vector<std::optional<std::string> > keys(flat.size());
+        Scheduler::run(flat.size(), jobs, [&](size_t i) { keys[i] = key_of(*groups[flat[i]].front()); });
+
+        std::map<std::string, Bucket> by_key;
+        for (size_t i = 0; i < flat.size(); ++i) {
+            if (keys[i])
+                by_key[*keys[i]].push_back(flat[i]);
+        }
+
+        std::vector<Bucket> out;
+        std::for_each(by_key.begin(), by_key.end(), [&](auto& it) {
+            if (it.second.size() > 1)
+                out.push_back(std::move(it.second));
+        });
+        return out;
+    };
+
+    // Size first, no I/O at all
+    std::map<off_t, Bucket> by_size;
+    for (size_t i = 0; i < groups.size(); ++i) {
+        if (candidates[i])
+            by_size[groups[i].front()->st.st_size].push_back(i);
+    }
+
+    std::vector<Bucket> buckets;
+    std::for_each(by_size.begin(), by_size.end(), [&](auto& it) {
+        if (it.second.size() > 1)
+            buckets.push_back(std::move(it.second));
+    });
+
+    buckets = refine(buckets, [](const Walker::Entry& e) -> std::optional<std::string> {
+        FD fd;
+        caddr_t content = nullptr;
+        size_t size = 0;
+        if (!map_elf(fd, e.path, content, size))
+            return std::nullopt;
+
+        uint64_t hash = 0;
+        auto el_class = elf_class(content);
+        if (el_class.first == Elf32)
+            class_entry<Elf32, DoElfQuickHash>(content, el_class.second, content, size, hash);
+        else
+            class_entry<Elf64, DoElfQuickHash>(content, el_class.second, content, size, hash);
+
+        return std::to_string(size) + ":" + std::to_string(hash);
+    });
+
+    // Full content hash only for the remaining collisions
+    buckets = refine(buckets, [](const Walker::Entry& e) -> std::optional<std::string> {
+        FD fd;
+        caddr_t content = nullptr;
+        size_t size = 0;
+        if (!map_elf(fd, e.path, content, size))
+            return std::nullopt;
+
+        fd.prefetch(content);
+
+        StreamHash hash;
+        hash.update(content, size);
+
+        std::string key(16, '\0');
+        hash.fill(&key[0], key.size());
+        return std::to_string(size) + ":" + key;
+    });
+
+    // The hash is not cryptographic: members are confirmed byte by byte
+    // against the first one, the others are patched on their own
+    Bucket flat;
+    std::vector<size_t> bucket_of;
+    for (size_t b = 0; b < buckets.size(); ++b) {
+        flat.insert(flat.end(), buckets[b].begin() + 1, buckets[b].end());
+        bucket_of.resize(flat.size(), b);
+    }
+
+    std::vector<char> same(flat.size(), false);
+    Scheduler::run(flat.size(), jobs, [&](size_t n) {
+        FD fd, first_fd;
+        caddr_t content = nullptr, first = nullptr;
+        size_t size = 0, first_size = 0;
+        if (map_elf(fd, groups[flat[n]].front()->path, content, size)
+            && map_elf(first_fd, groups[buckets[bucket_of[n]].front()].front()->path, first, first_size))
+            same[n] = size == first_size && ::memcmp(content, first, size) == 0;
+    });
+
+    std::vector<Bucket> sets(buckets.size());
+    for (size_t b = 0; b < buckets.size(); ++b)
+        sets[b].push_back(buckets[b].front());
+    for (size_t n = 0; n < flat.size(); ++n) {
+        if (same[n])
+            sets[bucket_of[n]].push_back(flat[n]);
+    }
+
+    std::vector<Bucket> confirmed;
+    std::for_each(sets.begin(), sets.end(), [&](auto& set) {
+        if (set.size() > 1)
+            confirmed.push_back(std::move(set));
+    });
+
+    return confirmed;
+}
+
+/*static*/ int Batch::reuse_patch(const Walker::Entry& follower, const Walker::Entry& leader, const Edits& edits, std::ostream& err) {
+    FD dst(::open(follower.path.c_str(), O_RDWR | O_CLOEXEC));
+    if (dst.bad()) {
+        err << "error: Can't open " << follower.path << "!" << std::endl;
+        return -1;
+    }
+
+    // Compared while collecting, must not have changed since
+    auto key = ScanCache::Key::of(dst.stat());
+    auto collected = ScanCache::Key::of(follower.st);
+    if (key.size != collected.size || key.mtime_ns != collected.mtime_ns) {
+        err << "error: " << follower.path << " changed while patching!" << std::endl;
+        return -1;
+    }
+
+    FD src(::open(leader.path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!src.bad() && ::ioctl(dst.get(), FICLONE, src.get()) == 0)
+        return 0;
+
+    bool ok = std::all_of(edits.begin(), edits.end(), [&](auto& e) {
+        return ::pwrite(dst.get(), e.second.data(), e.second.size(), e.first) == ssize_t(e.second.size());
+    });
+    if (!ok) {
+        err << "error: Can't write " << follower.path << "!" << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*static*/ int Batch::run(const Args& args) {
+    bool failed  = false;
+    auto entries = Walker::collect(args.filenames, std::cerr, false, &failed);
+    auto groups  = Walker::group_by_inode(entries);
+    bool batch   = entries.size() > 1 || entries.empty() || entries.front().from_dir;
+
+    std::optional<ScanCache> cache;
+    if (!args.cache.empty()) {
+        cache.emplace();
+        cache->load(args.cache);
+    }
+
+    std::optional<Journal> journal;
+    if (!args.journal.empty()) {
+        journal.emplace();
+        journal->load(args.journal);
+        journal->begin(args);
+    }
+
+    // Journaled paths that did not change and no changed rule applies to,
+    // none with digests: the output must not depend on the journal
+    std::vector<char> skipped(groups.size(), false);
+    int ret = (entries.empty() || failed) ? -1 : 0;
+    if (journal && !args.digest) {
+        for (size_t i = 0; i < groups.size(); ++i)
+            skipped[i] = std::all_of(groups[i].begin(), groups[i].end(), [&](auto* link) { return journal->unchanged(*link); });
+    }
+
+    // Identity after processing and dynamic strings for the journal
+    auto remember = [&](size_t i, int file_ret, const std::optional<ElfSummary>& summary, bool patched = true) {
+        if (!journal)
+            return;
+
+        auto& links = groups[i];
+        struct ::stat st = links.front()->st;
+        ::stat(links.front()->path.c_str(), &st);
+
+        auto result = (file_ret != 0) ? Journal::Error
+                    : !summary ? Journal::NotElf
+                    : patched ? Journal::Ok : Journal::NoOp;
+        std::for_each(links.begin(), links.end(), [&](auto* link) {
+            journal->record(link->path, st, result, summary ? &*summary : nullptr);
+        });
+    };
+
+    auto prefix_of = [batch](const Walker::Group& links) {
+        std::string prefix;
+        if (batch) {
+            std::for_each(links.begin(), links.end(), [&](auto* link) {
+                prefix += (prefix.empty() ? "" : ", ") + link->path;
+            });
+            prefix += ": ";
+        }
+        return prefix;
+    };
+
+    std::vector<Outcome> outcomes(groups.size());
+    std::mutex out_mutex;
+
+    auto flush = [&](std::ostringstream& out, std::ostringstream& err, int file_ret) {
+        std::lock_guard<std::mutex> lock(out_mutex);
+        std::cout << out.str() << std::flush;
+        std::cerr << err.str() << std::flush;
+        if (file_ret != 0)
+            ret = file_ret;
+    };
+
+    std::optional<Plan> recorded;
+    if (!args.record_plan.empty())
+        recorded.emplace();
+
+    std::optional<VersionCheck> versions;
+    if (args.verify_versions)
+        versions.emplace(args.library_path);
+
+    // Inputs known to a recorded plan get its edits, no ELF parsing at
+    // all. The rest is patched by the options, if there are any.
+    if (!args.replay_plan.empty()) {
+        Plan replay;
+        if (!replay.load(args.replay_plan)) {
+            std::cerr << "error: Can't load plan " << args.replay_plan << "!" << std::endl;
+            return -1;
+        }
+
+        bool patching = args.fingerprint() != 0;
+        Scheduler::run(groups.size(), args.jobs, [&](size_t i) {
+            if (skipped[i])
+                return;
+
+            auto& links = groups[i];
+            std::ostringstream out, err;
+            auto replayed = replay.replay(links.front()->path, err);
+            if (replayed == Plan::NoPlan && patching)
+                return;
+
+            skipped[i] = true;
+
+            int file_ret = (replayed == Plan::Applied || replayed == Plan::AlreadyApplied) ? 0 : -1;
+            if (replayed == Plan::NoPlan) {
+                bool from_dir = std::all_of(links.begin(), links.end(), [](auto* e) { return e->from_dir; });
+                if (!from_dir)
+                    err << "error: No recorded plan matches " << links.front()->path << "!" << std::endl;
+                flush(out, err, from_dir ? 0 : -1);
+                return;
+            }
+
+            if (journal) {
+                std::string error;
+                remember(i, file_ret, (file_ret == 0) ? Query::query_file(links.front()->path, error) : std::nullopt,
+                         replayed == Plan::Applied);
+            }
+            flush(out, err, file_ret);
+        });
+    }
+
+    // Identical inputs: patch the first one (leader) only, the others
+    // (followers) get the result afterwards.
+    std::vector<size_t> leader_of(groups.size());
+    for (size_t i = 0; i < groups.size(); ++i)
+        leader_of[i] = i;
+
+    if (args.dedup) {
+        std::vector<bool> candidates(groups.size(), true);
+        uint64_t rules = args.fingerprint();
+        for (size_t i = 0; i < groups.size(); ++i) {
+            auto record = cache ? cache->find(groups[i].front()->st) : std::nullopt;
+            candidates[i] = !skipped[i] && (!record || (record->kind == ScanCache::IsElf && record->rules != rules));
+        }
+
+        auto sets = identical_contents(groups, candidates, args.jobs);
+        std::for_each(sets.begin(), sets.end(), [&](auto& set) {
+            std::for_each(set.begin() + 1, set.end(), [&](auto i) { leader_of[i] = set.front(); });
+        });
+    }
+
+    std::vector<size_t> first, second;
+    for (size_t i = 0; i < groups.size(); ++i) {
+        if (!skipped[i])
+            (leader_of[i] == i ? first : second).push_back(i);
+    }
+
+    Scheduler::run(first.size(), args.jobs, [&](size_t n) {
+        auto i = first[n];
+        std::ostringstream out, err;
+        outcomes[i] = patch_file(groups[i], args, cache ? &*cache : nullptr, prefix_of(groups[i]), out, err,
+                                 recorded ? &*recorded : nullptr, versions ? &*versions : nullptr);
+        remember(i, outcomes[i].ret, outcomes[i].summary, outcomes[i].patched);
+        flush(out, err, outcomes[i].ret);
+    });
+
+    Scheduler::run(second.size(), args.jobs, [&](size_t n) {
+        auto i = second[n];
+        auto& leader = outcomes[leader_of[i]];
+        std::ostringstream out, err;
+
+        // Leader failed or was not patched: nothing to reuse
+        if (leader.ret != 0 || !leader.patched) {
+            outcomes[i] = patch_file(groups[i], args, cache ? &*cache : nullptr, prefix_of(groups[i]), out, err,
+                                     recorded ? &*recorded : nullptr, versions ? &*versions : nullptr);
+            remember(i, outcomes[i].ret, outcomes[i].summary, outcomes[i].patched);
+            flush(out, err, outcomes[i].ret);
+            return;
+        }
+
+        auto& links = groups[i];
+
+        // Same content, but new needed names resolve from another directory
+        if (versions && !args.neededs.empty()) {
+            FD fd;
+            caddr_t content = nullptr;
+            size_t size = 0;
+            auto problems = map_elf(fd, links.front()->path, content, size)
+                ? versions->check(content, size, links.front()->path, args.neededs)
+                : std::vector<std::string>{"Can't map " + links.front()->path + "!"};
+            if (!problems.empty()) {
+                std::for_each(problems.begin(), problems.end(), [&](auto& p) {
+                    err << prefix_of(links) << "error: " << p << std::endl;
+                });
+                remember(i, -1, std::nullopt);
+                flush(out, err, -1);
+                return;
+            }
+        }
+
+        int file_ret = reuse_patch(*links.front(), *groups[leader_of[i]].front(), leader.edits, err);
+
+        if (file_ret == 0 && args.digest) {
+            std::for_each(links.begin(), links.end(), [&](auto* link) {
+                emit_digest(link->path, link->st.st_size, leader.sha256, out);
+            });
+        }
+
+        if (file_ret == 0 && cache && leader.summary) {
+            struct ::stat st;
+            if (::stat(links.front()->path.c_str(), &st) == 0)
+                cache->record_elf(st, *leader.summary, args.fingerprint());
+        }
+
+        remember(i, file_ret, leader.summary);
+        flush(out, err, file_ret);
+    });
+
+    if (recorded && !recorded->save(args.record_plan)) {
+        std::cerr << "error: Can't write plan " << args.record_plan << "!" << std::endl;
+        ret = -1;
+    }
+
+    if (journal && !journal->save(args.journal)) {
+        std::cerr << "error: Can't write journal " << args.journal << "!" << std::endl;
+        ret = -1;
+    }
+
+    if (cache && !cache->save(args.cache)) {
+        std::cerr << "error: Can't write cache " << args.cache << "!" << std::endl;
+        ret = -1;
+    }
+
+    return ret;
+}
@@ -0,0 +1,443 @@
+#include <safe_patchelf/Compression.h>
+#include <safe_patchelf/Queue.h>
+#include <safe_patchelf/Tar.h>
+
+#include <unistd.h>
+
+#include <zlib.h>
+#include <lzma.h>
+#ifdef SAFE_PATCHELF_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <future>
+
+namespace {
+
+const size_t IO_SIZE    = 1 << 20;
+const size_t GZIP_BLOCK = 1 << 20;
+const int    GZIP_LEVEL = 6;
+const int    XZ_PRESET  = 6;
+const int    ZSTD_LEVEL = 3;
+
+// Input of a decompression stage: prefix first, then the descriptor
+class Source {
+public:
+    Source(const std::string& prefix, int fd)
+        : prefix_(prefix)
+        , fd_(fd)
+        , buf_(IO_SIZE)
+    {
+    }
+
+    // Next piece of input, empty at the end and on read error
+    const char* next(size_t& len) {
+        if (!prefix_done_) {
+            prefix_done_ = true;
+            if (!prefix_.empty()) {
+                len = prefix_.size();
+                return prefix_.data();
+            }
+        }
+
+        ssize_t n;
+        do {
+            n = ::read(fd_, buf_.data(), buf_.size());
+        } while (n < 0 && errno == EINTR);
+
+        failed_ |= n < 0;
+        len = (n > 0) ? n : 0;
+        return buf_.data();
+    }
+
+    bool failed() const { return failed_; }
+
+private:
+    const std::string& prefix_;
+    bool prefix_done_ = false;
+    bool failed_ = false;
+    int fd_;
+    std::vector<char> buf_;
+};
+
+// Up to len bytes, less only at the end of input
+ssize_t read_block(int fd, char* buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = ::read(fd, buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+bool gunzip(const std::string& prefix, int in, int out, std::ostream& err) {
+    z_stream zs{};
+    if (inflateInit2(&zs, 15 + 32) != Z_OK)
+        return false;
+
+    Source source(prefix, in);
+    std::vector<char> buf(IO_SIZE);
+    bool ended = false;
+    bool ok = true;
+
+    size_t len = 0;
+    for (const char* data = source.next(len); ok && len; data = source.next(len)) {
+        zs.next_in  = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zs.avail_in = len;
+
+        while (zs.avail_in) {
+            // Concatenated members (as written by compress) continue the stream
+            if (ended) {
+                inflateReset(&zs);
+                ended = false;
+            }
+
+            zs.next_out  = reinterpret_cast<Bytef*>(buf.data());
+            zs.avail_out = buf.size();
+            int rc = inflate(&zs, Z_NO_FLUSH);
+            if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+                err << "error: gzip: " << (zs.msg ? zs.msg : "corrupt input") << std::endl;
+                ok = false;
+                break;
+            }
+            ended = rc == Z_STREAM_END;
+
+            if (!Tar::write_full(out, buf.data(), buf.size() - zs.avail_out)) {
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    if (ok && (!ended || source.failed())) {
+        err << "error: gzip: truncated input" << std::endl;
+        ok = false;
+    }
+
+    inflateEnd(&zs);
+    return ok;
+}
+
+bool unxz(const std::string& prefix, int in, int out, std::ostream& err) {
+    lzma_stream strm = LZMA_STREAM_INIT;
+    if (lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+        return false;
+
+    Source source(prefix, in);
+    std::vector<char> buf(IO_SIZE);
+    bool ok = true;
+
+    lzma_action action = LZMA_RUN;
+    while (ok) {
+        // The piece stays valid until the next call
+        if (strm.avail_in == 0 && action == LZMA_RUN) {
+            size_t len = 0;
+            strm.next_in  = reinterpret_cast<const uint8_t*>(source.next(len));
+            strm.avail_in = len;
+            if (source.failed()) {
+                err << "error: xz: Can't read input" << std::endl;
+                ok = false;
+                break;
+            }
+            if (len == 0)
+                action = LZMA_FINISH;
+        }
+
+        strm.next_out  = reinterpret_cast<uint8_t*>(buf.data());
+        strm.avail_out = buf.size();
+        lzma_ret rc = lzma_code(&strm, action);
+
+        if (!Tar::write_full(out, buf.data(), buf.size() - strm.avail_out)) {
+            ok = false;
+            break;
+        }
+        if (rc == LZMA_STREAM_END)
+            break;
+        if (rc != LZMA_OK) {
+            err << "error: xz: corrupt input" << std::endl;
+            ok = false;
+            break;
+        }
+    }
+
+    lzma_end(&strm);
+    return ok;
+}
+
+bool gzip_parallel(int in, int out, unsigned jobs, std::ostream& err) {
+    // Blocks are compressed in parallel and written in input order
+    BoundedQueue<std::future<std::string> > queue(2 * jobs);
+    bool written = true;
+
+    std::thread writer([&] {
+        while (auto member = queue.pop()) {
+            auto data = member->get();
+            if (written && (data.empty() || !Tar::write_full(out, data.data(), data.size()))) {
+                written = false;
+                queue.close();
+            }
+        }
+    });
+
+    auto deflate_block = [](std::vector<char> block) {
+        z_stream zs{};
+        if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return std::string();
+
+        std::string member(deflateBound(&zs, block.size()), '\0');
+        zs.next_in   = reinterpret_cast<Bytef*>(block.data());
+        zs.avail_in  = block.size();
+        zs.next_out  = reinterpret_cast<Bytef*>(&member[0]);
+        zs.avail_out = member.size();
+        int rc = deflate(&zs, Z_FINISH);
+        member.resize(member.size() - zs.avail_out);
+        deflateEnd(&zs);
+
+        return (rc == Z_STREAM_END) ? member : std::string();
+    };
+
+    bool ok = true;
+    bool first = true;
+    while (true) {
+        std::vector<char> block(GZIP_BLOCK);
+        ssize_t n = read_block(in, block.data(), block.size());
+        if (n < 0) {
+            ok = false;
+            break;
+        }
+        // Empty input still gets one (empty) member
+        if (n == 0 && !first)
+            break;
+        first = false;
+
+        block.resize(n);
+        if (!queue.push(std::async(std::launch::async, deflate_block, std::move(block))))
+            break;
+        if (size_t(n) < GZIP_BLOCK)
+            break;
+    }
+
+    queue.close();
+    writer.join();
+
+    if (!ok || !written)
+        err << "error: gzip: Can't compress output" << std::endl;
+
+    return ok && written;
+}
+
+bool xz_parallel(int in, int out, unsigned jobs, std::ostream& err) {
+    lzma_mt mt{};
+    mt.threads = jobs;
+    mt.preset  = XZ_PRESET;
+    mt.check   = LZMA_CHECK_CRC64;
+
+    lzma_stream strm = LZMA_STREAM_INIT;
+    if (lzma_stream_encoder_mt(&strm, &mt) != LZMA_OK) {
+        err << "error: xz: Can't create encoder" << std::endl;
+        return false;
+    }
+
+    std::vector<char> inbuf(IO_SIZE), outbuf(IO_SIZE);
+    lzma_action action = LZMA_RUN;
+    bool ok = true;
+
+    while (ok) {
+        if (strm.avail_in == 0 && action == LZMA_RUN) {
+            ssize_t n = read_block(in, inbuf.data(), inbuf.size());
+            if (n < 0) {
+                ok = false;
+                break;
+            }
+            strm.next_in  = reinterpret_cast<const uint8_t*>(inbuf.data());
+            strm.avail_in = n;
+            if (n == 0)
+                action = LZMA_FINISH;
+        }
+
+        strm.next_out  = reinterpret_cast<uint8_t*>(outbuf.data());
+        strm.avail_out = outbuf.size();
+        lzma_ret rc = lzma_code(&strm, action);
+
+        if (!Tar::write_full(out, outbuf.data(), outbuf.size() - strm.avail_out)) {
+            ok = false;
+            break;
+        }
+        if (rc == LZMA_STREAM_END)
+            break;
+        if (rc != LZMA_OK)
+            ok = false;
+    }
+
+    if (!ok)
+        err << "error: xz: Can't compress output" << std::endl;
+
+    lzma_end(&strm);
+    return ok;
+}
+
+#ifdef SAFE_PATCHELF_WITH_ZSTD
+
+bool unzstd(const std::string& prefix, int in, int out, std::ostream& err) {
+    auto dctx = ZSTD_createDCtx();
+    if (!dctx)
+        return false;
+
+    Source source(prefix, in);
+    std::vector<char> buf(IO_SIZE);
+    bool ok = true;
+    size_t pending = 0;     // non zero inside of a frame
+
+    size_t len = 0;
+    for (const char* data = source.next(len); ok && len; data = source.next(len)) {
+        ZSTD_inBuffer input{data, len, 0};
+        while (input.pos < input.size) {
+            ZSTD_outBuffer output{buf.data(), buf.size(), 0};
+            pending = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(pending)) {
+                err << "error: zstd: " << ZSTD_getErrorName(pending) << std::endl;
+                ok = false;
+                break;
+            }
+            if (!Tar::write_full(out, buf.data(), output.pos)) {
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    // Output of the last block may still sit in the decoder when it filled
+    // the buffer, drain it with empty input until nothing comes out
+    while (ok && pending && !source.failed()) {
+        ZSTD_inBuffer input{nullptr, 0, 0};
+        ZSTD_outBuffer output{buf.data(), buf.size(), 0};
+        pending = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(pending)) {
+            err << "error: zstd: " << ZSTD_getErrorName(pending) << std::endl;
+            ok = false;
+            break;
+        }
+        if (!Tar::write_full(out, buf.data(), output.pos))
+            ok = false;
+        if (output.pos == 0)
+            break;
+    }
+
+    if (ok && (pending || source.failed())) {
+        err << "error: zstd: truncated input" << std::endl;
+        ok = false;
+    }
+
+    ZSTD_freeDCtx(dctx);
+    return ok;
+}
+
+bool zstd_parallel(int in, int out, unsigned jobs, std::ostream& err) {
+    auto cctx = ZSTD_createCCtx();
+    if (!cctx)
+        return false;
+
+    // Worker threads need a multi threaded libzstd, single threaded otherwise
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, ZSTD_LEVEL);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, int(jobs));
+
+    std::vector<char> inbuf(IO_SIZE), outbuf(IO_SIZE);
+    bool ok = true;
+
+    while (ok) {
+        ssize_t n = read_block(in, inbuf.data(), inbuf.size());
+        if (n < 0) {
+            ok = false;
+            break;
+        }
+
+        auto mode = (n == 0) ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer input{inbuf.data(), size_t(n), 0};
+        bool finished = false;
+        while (ok && !finished) {
+            ZSTD_outBuffer output{outbuf.data(), outbuf.size(), 0};
+            size_t remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+            if (ZSTD_isError(remaining) || !Tar::write_full(out, outbuf.data(), output.pos)) {
+                ok = false;
+                break;
+            }
+            finished = (mode == ZSTD_e_end) ? remaining == 0 : input.pos == input.size;
+        }
+
+        if (n == 0)
+            break;
+    }
+
+    if (!ok)
+        err << "error: zstd: Can't compress output" << std::endl;
+
+    ZSTD_freeCCtx(cctx);
+    return ok;
+}
+
+#endif
+
+} // namespace
+
+/*static*/ Compression::Format Compression::detect(const char* data, size_t len) {
+    if (len >= 2 && uint8_t(data[0]) == 0x1f && uint8_t(data[1]) == 0x8b)
+        return Gzip;
+    if (len >= 6 && ::memcmp(data, "\xfd" "7zXZ\0", 6) == 0)
+        return Xz;
+    if (len >= 4 && ::memcmp(data, "\x28\xb5\x2f\xfd", 4) == 0)
+        return Zstd;
+    return None;
+}
+
+/*static*/ const char* Compression::name(Format format) {
+    switch (format) {
+    case Gzip: return "gzip";
+    case Xz:   return "xz";
+    case Zstd: return "zstd";
+    default:   return "none";
+    }
+}
+
+/*static*/ bool Compression::supported(Format format) {
+#ifdef SAFE_PATCHELF_WITH_ZSTD
+    return true;
+#else
+    return format != Zstd;
+#endif
+}
+
+/*static*/ bool Compression::decompress(Format format, const std::string& prefix, int in, int out, std::ostream& err) {
+    switch (format) {
+    case Gzip: return gunzip(prefix, in, out, err);
+    case Xz:   return unxz(prefix, in, out, err);
+#ifdef SAFE_PATCHELF_WITH_ZSTD
+    case Zstd: return unzstd(prefix, in, out, err);
+#endif
+    default:
+        err << "error: " << name(format) << " is not supported!" << std::endl;
+        return false;
+    }
+}
+
+/*static*/ bool Compression::compress(Format format, int in, int out, unsigned jobs, std::ostream& err) {
+    switch (format) {
+    case Gzip: return gzip_parallel(in, out, jobs, err);
+    case Xz:   return xz_parallel(in, out, jobs, err);
+#ifdef SAFE_PATCHELF_WITH_ZSTD
+    case Zstd: return zstd_parallel(in, out, jobs, err);
+#endif
+    default:
+        err << "error: " << name(format) << " is not supported!" << std::endl;
+        return false;
+    }
+}
@@ -0,0 +1,253 @@
+#include <safe_patchelf/Cpio.h>
+#include <safe_patchelf/Batch.h>
+#include <safe_patchelf/Dispatch.h>
+#include <safe_patchelf/Scheduler.h>
+#include <safe_patchelf/FD.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <sstream>
+#include <optional>
+#include <algorithm>
+
+namespace {
+
+enum : size_t {
+    HEADER_SIZE = 110,
+    ALIGN       = 4,
+};
+
+// Offsets of the 8 hex digit fields after the 6 byte magic
+enum : size_t {
+    MODE_FIELD      = 14,
+    FILESIZE_FIELD  = 54,
+    NAMESIZE_FIELD  = 94,
+    CHECK_FIELD     = 102,
+};
+
+const char MAGIC[]      = "070701";
+const char MAGIC_CRC[]  = "070702";
+const char TRAILER[]    = "TRAILER!!!";
+
+size_t align(size_t v) {
+    return (v + ALIGN - 1) & ~size_t(ALIGN - 1);
+}
+
+std::optional<uint32_t> hex(const char* field) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        char c = field[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            return std::nullopt;
+        value = value << 4 | digit;
+    }
+    return value;
+}
+
+struct Member {
+    std::string name;
+    size_t header;
+    size_t data;
+    size_t size;
+    bool checksum;              // 070702: header carries the byte sum of the data
+
+    // Patch result
+    int ret = 0;
+    Batch::Ranges ranges;
+    std::string messages;
+};
+
+// Regular file members with content, over all concatenated archives
+std::optional<std::vector<Member> > read_members(const char* content, size_t size, size_t& count, std::string& error) {
+    std::vector<Member> members;
+    count = 0;
+
+    size_t pos = 0;
+    while (true) {
+        // Archives may be padded and concatenated
+        while (pos < size && content[pos] == '\0')
+            ++pos;
+        pos = align(pos);
+        if (pos >= size)
+            break;
+
+        if (size - pos < HEADER_SIZE
+            || (::memcmp(content + pos, MAGIC, 6) != 0 && ::memcmp(content + pos, MAGIC_CRC, 6) != 0)) {
+            if (count == 0) {
+                error = "Not a newc cpio archive";
+                return std::nullopt;
+            }
+            // Compressed segment, not for in place patching
+            break;
+        }
+
+        const char* h = content + pos;
+        auto mode     = hex(h + MODE_FIELD);
+        auto filesize = hex(h + FILESIZE_FIELD);
+        auto namesize = hex(h + NAMESIZE_FIELD);
+        if (!mode || !filesize || !namesize || *namesize == 0 || *namesize > size - pos - HEADER_SIZE) {
+            error = "Broken header at offset " + std::to_string(pos);
+            return std::nullopt;
+        }
+
+        std::string name(h + HEADER_SIZE, ::strnlen(h + HEADER_SIZE, *namesize));
+        size_t data = align(pos + HEADER_SIZE + *namesize);
+        if (data > size || *filesize > size - data) {
+            error = "Truncated member " + name;
+            return std::nullopt;
+        }
+
+        pos = align(data + *filesize);
+        if (name == TRAILER)
+            continue;
+
+        ++count;
+        if ((*mode & S_IFMT) != S_IFREG || *filesize < EI_NIDENT)
+            continue;
+        if (elf_class(const_cast<char*>(content + data)).first == None)
+            continue;
+
+        Member m;
+        m.name     = std::move(name);
+        m.header   = h - content;
+        m.data     = data;
+        m.size     = *filesize;
+        m.checksum = ::memcmp(h, MAGIC_CRC, 6) == 0;
+        members.push_back(std::move(m));
+    }
+
+    return members;
+}
+
+bool pwrite_full(int fd, const void* buf, size_t len, size_t offset) {
+    auto p = reinterpret_cast<const char*>(buf);
+    while (len) {
+        ssize_t n = ::pwrite(fd, p, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+} // namespace
+
+/*static*/ int Cpio::patch(const std::string& path, const Args& args, std::ostream& out, std::ostream& err, Stats* stats) {
+    FD fd(::open(path.c_str(), O_RDWR | O_CLOEXEC));
+    if (fd.bad()) {
+        err << "error: Can't open " << path << " for writing!" << std::endl;
+        return -1;
+    }
+
+    auto st = fd.stat();
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+        err << "error: " << path << ": Not a newc cpio archive!" << std::endl;
+        return -1;
+    }
+
+    // Private and writable: patching touches copies of the pages only,
+    // the modified ranges of successfully patched members are written
+    // back to the file at the end.
+    auto content = reinterpret_cast<char*>(fd.mmap(0, 0, PROT_READ | PROT_WRITE, MAP_FILE | MAP_PRIVATE));
+    if (!content) {
+        err << "error: Can't map " << path << "!" << std::endl;
+        return -1;
+    }
+
+    size_t count = 0;
+    std::string error;
+    auto members = read_members(content, st.st_size, count, error);
+    if (!members) {
+        err << "error: " << path << ": " << error << "!" << std::endl;
+        return -1;
+    }
+
+    unsigned jobs = args.jobs ? args.jobs : Scheduler::default_jobs();
+    Scheduler::run(members->size(), jobs, [&](size_t i) {
+        auto& m = (*members)[i];
+        std::ostringstream messages;
+        m.ret = Batch::patch_buffer(content + m.data, m.size, args, path + "!" + m.name + ": ",
+                                    messages, messages, nullptr, &m.ranges);
+        m.messages = messages.str();
+    });
+
+    Stats total;
+    total.members = count;
+    total.elf     = members->size();
+
+    int ret = 0;
+    std::for_each(members->begin(), members->end(), [&](auto& m) {
+        (m.ret != 0 ? err : out) << m.messages;
+        if (m.ret != 0) {
+            ret = -1;
+            ++total.failed;
+            return;
+        }
+        if (m.ranges.empty())
+            return;
+
+        // Byte sum of the data changes by the difference over the ranges
+        uint32_t sum_delta = 0;
+        bool ok = std::all_of(m.ranges.begin(), m.ranges.end(), [&](auto& r) {
+            if (m.checksum) {
+                std::vector<char> old(r.second);
+                if (::pread(fd.get(), old.data(), old.size(), m.data + r.first) != ssize_t(old.size()))
+                    return false;
+                for (size_t i = 0; i < r.second; ++i)
+                    sum_delta += uint8_t(content[m.data + r.first + i]) - uint8_t(old[i]);
+            }
+            return pwrite_full(fd.get(), content + m.data + r.first, r.second, m.data + r.first);
+        });
+
+        if (ok && m.checksum) {
+            auto check = hex(content + m.header + CHECK_FIELD);
+            char field[9];
+            ::snprintf(field, sizeof(field), "%08x", unsigned(check.value_or(0) + sum_delta));
+            ok = pwrite_full(fd.get(), field, 8, m.header + CHECK_FIELD);
+        }
+
+        if (!ok) {
+            err << "error: " << path << "!" << m.name << ": Can't write!" << std::endl;
+            ret = -1;
+            ++total.failed;
+            return;
+        }
+        ++total.changed;
+    });
+
+    if (stats)
+        *stats = total;
+
+    return ret;
+}
+
+/*static*/ int Cpio::run(const Args& args) {
+    int ret = 0;
+
+    std::for_each(args.filenames.begin(), args.filenames.end(), [&](auto& path) {
+        Stats stats;
+        if (patch(path, args, std::cout, std::cerr, &stats) != 0)
+            ret = -1;
+
+        std::cout << "cpio: " << path << ": " << stats.members << " members, " << stats.elf << " ELF, "
+                  << stats.changed << " patched, " << stats.failed << " failed" << std::endl;
+    });
+
+    return ret;
+}
@@ -1,8 +1,10 @@
 #include <safe_patchelf/FD.h>
 
 #include <fcntl.h>
+#include <stdlib.h>
 
 #include <algorithm>
+#include <vector>
 
 FD::FD(int initial)
     : fd_(initial)
@@ -17,6 +19,17 @@ FD::FD(FD&& src)
     src.maps_.clear();
 }
 
+FD& FD::operator=(FD&& src) {
+    if (this != &src) {
+        close();
+        fd_   = src.fd_;
+        maps_ = std::move(src.maps_);
+        src.fd_ = BAD;
+        src.maps_.clear();
+    }
+    return *this;
+}
+
 FD::~FD() {
     close();
 }
@@ -50,7 +63,7 @@ void* FD::mmap(off_t off, size_t in_len, int prot, int flags) {
     size_t len = (in_len != 0) ? (in_len) : (size() - off);
 
     auto addr = ::mmap(nullptr, len, prot, flags, fd_, off);
-    if (!addr)
+    if (addr == MAP_FAILED)
         return nullptr;
 
     auto ret = maps_.insert(std::make_pair(addr, len));
@@ -60,3 +73,39 @@ void* FD::mmap(off_t off, size_t in_len, int prot, int flags) {
 
     return addr;
 }
+
+void FD::prefetch(void* addr) const {
+    auto it = maps_.find(addr);
+    if (it == maps_.end())
+        return;
+
+    size_t page = ::sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> vec((it->second + page - 1) / page);
+    if (::mincore(addr, it->second, vec.data()) == 0
+        && std::all_of(vec.begin(), vec.end(), [](auto v) { return v & 1; }))
+        return;
+
+    ::madvise(addr, it->second, MADV_SEQUENTIAL);
+    ::madvise(addr, it->second, MADV_WILLNEED);
+}
+
+/*static*/ FD FD::temp_beside(const std::string& path, std::string& tmp) {
+    tmp = path + ".XXXXXX";
+    FD fd(::mkostemp(&tmp[0], O_CLOEXEC));
+    if (fd.bad())
+        return fd;
+
+    // mkostemp creates 0600, the umask can only be read by setting it
+    struct ::stat st;
+    mode_t mode;
+    if (::stat(path.c_str(), &st) == 0) {
+        mode = st.st_mode & 07777;
+    } else {
+        mode_t mask = ::umask(022);
+        ::umask(mask);
+        mode = 0666 & ~mask;
+    }
+    ::fchmod(fd.get(), mode);
+
+    return fd;
+}
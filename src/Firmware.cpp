@@ -0,0 +1,158 @@
+#include <safe_patchelf/Firmware.h>
+#include <safe_patchelf/Batch.h>
+#include <safe_patchelf/Dispatch.h>
+#include <safe_patchelf/Scheduler.h>
+#include <safe_patchelf/FD.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+
+namespace {
+
+struct Result {
+    int ret = 0;
+    Batch::Ranges ranges;
+    std::string messages;
+};
+
+bool pwrite_full(int fd, const void* buf, size_t len, size_t offset) {
+    auto p = reinterpret_cast<const char*>(buf);
+    while (len) {
+        ssize_t n = ::pwrite(fd, p, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+std::string hex_offset(size_t offset) {
+    std::ostringstream out;
+    out << "0x" << std::hex << offset;
+    return out.str();
+}
+
+} // namespace
+
+/*static*/ std::vector<Firmware::Image> Firmware::find_images(const char* content, size_t size) {
+    std::vector<Image> images;
+
+    size_t pos = 0;
+    while (size - pos >= EI_NIDENT) {
+        auto hit = reinterpret_cast<const char*>(::memmem(content + pos, size - pos, ELFMAG, SELFMAG));
+        if (!hit)
+            break;
+
+        size_t offset = hit - content;
+        size_t rest   = size - offset;
+
+        auto image = const_cast<caddr_t>(hit);
+        auto extent = (rest >= EI_NIDENT) ? elf_extent(image, rest, elf_class(image)) : std::nullopt;
+        if (!extent) {
+            pos = offset + 1;
+            continue;
+        }
+
+        images.push_back(Image{offset, *extent});
+        pos = offset + *extent;
+    }
+
+    return images;
+}
+
+/*static*/ int Firmware::patch(const std::string& path, const Args& args, std::ostream& out, std::ostream& err, Stats* stats) {
+    FD fd(::open(path.c_str(), O_RDWR | O_CLOEXEC));
+    if (fd.bad()) {
+        err << "error: Can't open " << path << " for writing!" << std::endl;
+        return -1;
+    }
+
+    size_t size = fd.size();
+    if (size < EI_NIDENT) {
+        err << "error: " << path << ": No ELF images!" << std::endl;
+        return -1;
+    }
+
+    // Private and writable: patching touches copies of the pages only,
+    // the modified ranges of successfully patched images are written
+    // back to the file at the end.
+    auto content = reinterpret_cast<char*>(fd.mmap(0, 0, PROT_READ | PROT_WRITE, MAP_FILE | MAP_PRIVATE));
+    if (!content) {
+        err << "error: Can't map " << path << "!" << std::endl;
+        return -1;
+    }
+    ::madvise(content, size, MADV_SEQUENTIAL);
+
+    auto images = find_images(content, size);
+    if (images.empty()) {
+        err << "error: " << path << ": No ELF images!" << std::endl;
+        return -1;
+    }
+
+    std::vector<Result> results(images.size());
+    unsigned jobs = args.jobs ? args.jobs : Scheduler::default_jobs();
+    Scheduler::run(images.size(), jobs, [&](size_t i) {
+        std::ostringstream messages;
+        results[i].ret = Batch::patch_buffer(content + images[i].offset, images[i].size, args,
+                                             path + "@" + hex_offset(images[i].offset) + ": ",
+                                             messages, messages, nullptr, &results[i].ranges);
+        results[i].messages = messages.str();
+    });
+
+    Stats total;
+    total.images = images.size();
+
+    int ret = 0;
+    for (size_t i = 0; i < images.size(); ++i) {
+        auto& result = results[i];
+        (result.ret != 0 ? err : out) << result.messages;
+        if (result.ret != 0) {
+            ret = -1;
+            ++total.failed;
+            continue;
+        }
+        if (result.ranges.empty())
+            continue;
+
+        bool ok = std::all_of(result.ranges.begin(), result.ranges.end(), [&](auto& r) {
+            size_t offset = images[i].offset + r.first;
+            return pwrite_full(fd.get(), content + offset, r.second, offset);
+        });
+        if (!ok) {
+            err << "error: " << path << "@" << hex_offset(images[i].offset) << ": Can't write!" << std::endl;
+            ret = -1;
+            ++total.failed;
+            continue;
+        }
+        ++total.changed;
+    }
+
+    if (stats)
+        *stats = total;
+
+    return ret;
+}
+
+/*static*/ int Firmware::run(const Args& args) {
+    int ret = 0;
+
+    std::for_each(args.filenames.begin(), args.filenames.end(), [&](auto& path) {
+        Stats stats;
+        if (patch(path, args, std::cout, std::cerr, &stats) != 0)
+            ret = -1;
+
+        std::cout << "blob: " << path << ": " << stats.images << " ELF images, "
+                  << stats.changed << " patched, " << stats.failed << " failed" << std::endl;
+    });
+
+    return ret;
+}
@@ -0,0 +1,421 @@
+#include <safe_patchelf/Graph.h>
+#include <safe_patchelf/Query.h>
+#include <safe_patchelf/Walker.h>
+#include <safe_patchelf/Scheduler.h>
+#include <safe_patchelf/Json.h>
+
+#include <elf/elf.h>
+
+#include <glob.h>
+#include <unistd.h>
+
+#include <climits>
+
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+namespace {
+
+std::vector<std::string> split(const std::string& s, char sep) {
+    std::vector<std::string> out;
+    std::string::size_type start = 0;
+    while (start <= s.size()) {
+        auto end = s.find(sep, start);
+        if (end == std::string::npos)
+            end = s.size();
+        out.push_back(s.substr(start, end - start));
+        start = end + 1;
+    }
+    return out;
+}
+
+std::string dirname(const std::string& path) {
+    auto it = path.rfind('/');
+    if (it == std::string::npos || it == 0)
+        return "/";
+    return path.substr(0, it);
+}
+
+std::string replace_all(std::string s, const std::string& from, const std::string& to) {
+    for (auto it = s.find(from); it != std::string::npos; it = s.find(from, it + to.size()))
+        s.replace(it, from.size(), to);
+    return s;
+}
+
+} // namespace
+
+DepGraph::DepGraph(std::string root)
+    : root_(std::move(root))
+{
+    while (root_.size() > 1 && root_.back() == '/')
+        root_.pop_back();
+}
+
+bool DepGraph::scan(unsigned jobs, std::ostream& err, ScanCache* cache) {
+    bool failed = false;
+    auto entries = Walker::collect({root_}, err, true, &failed);
+
+    std::vector<std::optional<ElfSummary> > summaries(entries.size());
+    std::vector<std::string> targets(entries.size());
+
+    Scheduler::run(entries.size(), jobs, [&](size_t i) {
+        auto& entry = entries[i];
+        if (S_ISLNK(entry.st.st_mode)) {
+            char buf[PATH_MAX];
+            auto len = ::readlink(entry.path.c_str(), buf, sizeof(buf));
+            if (len > 0)
+                targets[i].assign(buf, len);
+        } else {
+            std::string error;
+            summaries[i] = Query::query_entry(entry, cache, error);
+        }
+    });
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        auto rel = entries[i].path.substr(root_.size());
+
+        if (!targets[i].empty()) {
+            links_.emplace(rel, std::move(targets[i]));
+            continue;
+        }
+
+        auto& summary = summaries[i];
+        if (!summary || (summary->type != ET_DYN && summary->type != ET_EXEC))
+            continue;
+
+        Node node;
+        node.path      = strings_.intern(rel);
+        node.elf_class = (summary->elf_class == "ELF64") ? 64 : 32;
+        node.machine   = summary->machine;
+        if (summary->soname)
+            node.soname = strings_.intern(*summary->soname);
+        std::for_each(summary->needed.begin(), summary->needed.end(), [&](auto& n) {
+            node.needed.push_back(strings_.intern(n));
+        });
+
+        // DT_RPATH is ignored by ld.so when DT_RUNPATH is present
+        auto& search = summary->runpath ? summary->runpath : summary->rpath;
+        if (search) {
+            auto dirs = split(*search, ':');
+            std::for_each(dirs.begin(), dirs.end(), [&](auto& d) {
+                if (!d.empty())
+                    node.search.push_back(strings_.intern(d));
+            });
+        }
+        node.runpath = bool(summary->runpath);
+
+        node_by_path_.emplace(rel, Id(nodes_.size()));
+        nodes_.push_back(std::move(node));
+    }
+
+    load_ld_so_conf(root_, "/etc/ld.so.conf", conf_dirs_);
+
+    if (!failed && nodes_.empty())
+        err << "error: No ELF objects in " << root_ << "!" << std::endl;
+    return !failed && !nodes_.empty();
+}
+
+/*static*/ void DepGraph::load_ld_so_conf(const std::string& root, const std::string& conf, std::vector<std::string>& dirs, int depth) {
+    if (depth > 8)
+        return;
+
+    std::ifstream in(root + conf);
+    std::string line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::string word;
+        if (!(words >> word))
+            continue;
+
+        if (word == "include") {
+            std::string pattern;
+            while (words >> pattern) {
+                if (pattern[0] != '/')
+                    pattern = dirname(conf) + "/" + pattern;
+
+                glob_t g;
+                if (::glob((root + pattern).c_str(), 0, nullptr, &g) == 0) {
+                    for (size_t i = 0; i < g.gl_pathc; ++i)
+                        load_ld_so_conf(root, std::string(g.gl_pathv[i]).substr(root.size()), dirs, depth + 1);
+                }
+                ::globfree(&g);
+            }
+        } else if (word != "hwcap" && word[0] == '/') {
+            dirs.push_back(word);
+        }
+    }
+}
+
+std::optional<std::string> DepGraph::realpath(const std::string& path) const {
+    std::deque<std::string> todo;
+    auto comps = split(path, '/');
+    todo.insert(todo.end(), comps.begin(), comps.end());
+
+    std::vector<std::string> done;
+    int hops = 0;
+
+    while (!todo.empty()) {
+        auto c = std::move(todo.front());
+        todo.pop_front();
+
+        if (c.empty() || c == ".")
+            continue;
+        if (c == "..") {
+            if (!done.empty())
+                done.pop_back();
+            continue;
+        }
+
+        done.push_back(std::move(c));
+
+        std::string cur;
+        std::for_each(done.begin(), done.end(), [&](auto& d) { cur += "/" + d; });
+
+        auto link = links_.find(cur);
+        if (link == links_.end())
+            continue;
+
+        if (++hops > 40)
+            return std::nullopt;
+
+        done.pop_back();
+        if (!link->second.empty() && link->second[0] == '/')
+            done.clear();
+
+        auto target = split(link->second, '/');
+        todo.insert(todo.begin(), target.begin(), target.end());
+    }
+
+    std::string out;
+    std::for_each(done.begin(), done.end(), [&](auto& d) { out += "/" + d; });
+    return out.empty() ? std::string("/") : out;
+}
+
+DepGraph::Id DepGraph::lookup(const std::string& path) const {
+    auto real = realpath(path);
+    if (!real)
+        return NONE;
+
+    auto it = node_by_path_.find(*real);
+    return (it != node_by_path_.end()) ? it->second : NONE;
+}
+
+std::string DepGraph::expand(const std::string& dir, const Node& node) const {
+    auto origin = dirname(strings_.str(node.path));
+    auto lib    = (node.elf_class == 64) ? "lib64" : "lib";
+
+    auto out = replace_all(dir, "${ORIGIN}", origin);
+    out = replace_all(out, "$ORIGIN", origin);
+    out = replace_all(out, "${LIB}", lib);
+    out = replace_all(out, "$LIB", lib);
+    return out;
+}
+
+std::vector<std::string> DepGraph::default_dirs(const Node& node) const {
+    std::vector<std::string> dirs(conf_dirs_);
+    if (node.elf_class == 64) {
+        dirs.push_back("/lib64");
+        dirs.push_back("/usr/lib64");
+    }
+    dirs.push_back("/lib");
+    dirs.push_back("/usr/lib");
+    return dirs;
+}
+
+void DepGraph::resolve() {
+    // (expanded directory, needed) -> candidate paths are shared by many
+    // objects, cache the in-memory symlink resolution.
+    std::unordered_map<std::string, Id> cache;
+
+    auto lookup_cached = [&](const std::string& path) {
+        auto it = cache.find(path);
+        if (it != cache.end())
+            return it->second;
+        auto id = lookup(path);
+        cache.emplace(path, id);
+        return id;
+    };
+
+    for (Id n = 0; n < nodes_.size(); ++n) {
+        auto& node = nodes_[n];
+        node.deps.assign(node.needed.size(), NONE);
+
+        std::vector<std::string> dirs;
+        std::for_each(node.search.begin(), node.search.end(), [&](auto d) {
+            dirs.push_back(expand(strings_.str(d), node));
+        });
+        auto defaults = default_dirs(node);
+        dirs.insert(dirs.end(), defaults.begin(), defaults.end());
+
+        for (size_t i = 0; i < node.needed.size(); ++i) {
+            auto& needed = strings_.str(node.needed[i]);
+
+            std::vector<Id> candidates;
+            auto consider = [&](const std::string& path) {
+                auto c = lookup_cached(path);
+                if (c == NONE || std::find(candidates.begin(), candidates.end(), c) != candidates.end())
+                    return;
+                // ld.so skips objects of the wrong class or machine
+                if (nodes_[c].elf_class != node.elf_class || nodes_[c].machine != node.machine)
+                    return;
+                candidates.push_back(c);
+            };
+
+            if (needed.find('/') != std::string::npos) {
+                consider(expand(needed, node));
+            } else {
+                std::for_each(dirs.begin(), dirs.end(), [&](auto& d) { consider(d + "/" + needed); });
+            }
+
+            if (candidates.empty()) {
+                problems_.push_back(Problem{Problem::Missing, {n}, node.needed[i]});
+                continue;
+            }
+
+            node.deps[i] = candidates.front();
+            ++edges_;
+
+            if (candidates.size() > 1) {
+                Problem p{Problem::Ambiguous, {n}, node.needed[i]};
+                p.nodes.insert(p.nodes.end(), candidates.begin(), candidates.end());
+                problems_.push_back(std::move(p));
+            }
+        }
+    }
+}
+
+// Iterative Tarjan SCC, every SCC with more than one node (or a self
+// loop) is a dependency cycle.
+void DepGraph::find_cycles() {
+    const Id count = nodes_.size();
+
+    std::vector<Id> index(count, NONE), low(count, 0);
+    std::vector<bool> on_stack(count, false);
+    std::vector<Id> stack;
+    std::vector<std::pair<Id, size_t> > call;
+    Id next_index = 0;
+
+    for (Id start = 0; start < count; ++start) {
+        if (index[start] != NONE)
+            continue;
+
+        call.push_back(std::make_pair(start, 0));
+        while (!call.empty()) {
+            auto& frame = call.back();
+            Id v = frame.first;
+
+            if (frame.second == 0) {
+                index[v] = low[v] = next_index++;
+                stack.push_back(v);
+                on_stack[v] = true;
+            }
+
+            auto& deps = nodes_[v].deps;
+            bool descended = false;
+            while (frame.second < deps.size()) {
+                Id w = deps[frame.second++];
+                if (w == NONE)
+                    continue;
+                if (index[w] == NONE) {
+                    call.push_back(std::make_pair(w, 0));
+                    descended = true;
+                    break;
+                }
+                if (on_stack[w])
+                    low[v] = std::min(low[v], index[w]);
+            }
+            if (descended)
+                continue;
+
+            if (low[v] == index[v]) {
+                Problem p{Problem::Cycle, {}, NONE};
+                Id w;
+                do {
+                    w = stack.back();
+                    stack.pop_back();
+                    on_stack[w] = false;
+                    p.nodes.push_back(w);
+                } while (w != v);
+
+                bool self_loop = std::find(nodes_[v].deps.begin(), nodes_[v].deps.end(), v) != nodes_[v].deps.end();
+                if (p.nodes.size() > 1 || self_loop) {
+                    std::reverse(p.nodes.begin(), p.nodes.end());
+                    problems_.push_back(std::move(p));
+                }
+            }
+
+            call.pop_back();
+            if (!call.empty())
+                low[call.back().first] = std::min(low[call.back().first], low[v]);
+        }
+    }
+}
+
+void DepGraph::report(std::ostream& out) const {
+    size_t counts[3] = {0, 0, 0};
+
+    std::for_each(problems_.begin(), problems_.end(), [&](auto& p) {
+        static const char* names[] = {"missing", "ambiguous", "cycle"};
+        ++counts[p.type];
+
+        out << "{\"type\":\"" << names[p.type] << "\"";
+        if (p.type == Problem::Cycle) {
+            out << ",\"files\":[";
+        } else {
+            out << ",\"file\":";
+            Json::quoted(out, strings_.str(nodes_[p.nodes.front()].path));
+            out << ",\"needed\":";
+            Json::quoted(out, strings_.str(p.needed));
+            out << ",\"providers\":[";
+        }
+
+        auto first = (p.type == Problem::Cycle) ? p.nodes.begin() : p.nodes.begin() + 1;
+        for (auto it = first; it != p.nodes.end(); ++it) {
+            if (it != first)
+                out << ",";
+            Json::quoted(out, strings_.str(nodes_[*it].path));
+        }
+        out << "]}\n";
+    });
+
+    out << "{\"type\":\"summary\",\"root\":";
+    Json::quoted(out, root_);
+    out << ",\"objects\":" << nodes_.size()
+        << ",\"edges\":" << edges_
+        << ",\"missing\":" << counts[Problem::Missing]
+        << ",\"ambiguous\":" << counts[Problem::Ambiguous]
+        << ",\"cycles\":" << counts[Problem::Cycle]
+        << "}" << std::endl;
+}
+
+/*static*/ int DepGraph::run(const Args& args) {
+    bool success = true;
+
+    std::optional<ScanCache> cache;
+    if (!args.cache.empty()) {
+        cache.emplace();
+        cache->load(args.cache);
+    }
+
+    std::for_each(args.filenames.begin(), args.filenames.end(), [&](auto& root) {
+        DepGraph graph(root);
+        success &= graph.scan(args.jobs, std::cerr, cache ? &*cache : nullptr);
+        graph.resolve();
+        graph.find_cycles();
+        graph.report(std::cout);
+
+        success &= std::none_of(graph.problems().begin(), graph.problems().end(), [](auto& p) {
+            return p.type == Problem::Missing;
+        });
+    });
+
+    if (cache && !cache->save(args.cache)) {
+        std::cerr << "error: Can't write cache " << args.cache << "!" << std::endl;
+        success = false;
+    }
+
+    return success ? 0 : -1;
+}
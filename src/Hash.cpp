@@ -0,0 +1,295 @@
+#include <safe_patchelf/Hash.h>
+
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+const uint64_t P1 = 11400714785074694791ULL;
+const uint64_t P2 = 14029467366897019727ULL;
+const uint64_t P3 =  1609587929392839161ULL;
+const uint64_t P4 =  9650029242287828579ULL;
+const uint64_t P5 =  2870177450012600261ULL;
+
+inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    ::memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    ::memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input) {
+    acc += input * P2;
+    acc  = rotl(acc, 31);
+    acc *= P1;
+    return acc;
+}
+
+inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+    acc ^= round(0, val);
+    acc  = acc * P1 + P4;
+    return acc;
+}
+
+inline uint64_t splitmix64(uint64_t& state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+const uint8_t zero_block[4096] = {0};
+
+} // namespace
+
+Xxh64::Xxh64(uint64_t seed)
+    : v_{seed + P1 + P2, seed + P2, seed, seed - P1}
+    , seed_(seed)
+    , total_(0)
+    , buf_{0}
+    , buf_len_(0)
+{
+}
+
+void Xxh64::consume(const uint8_t* block) {
+    v_[0] = round(v_[0], read64(block));
+    v_[1] = round(v_[1], read64(block + 8));
+    v_[2] = round(v_[2], read64(block + 16));
+    v_[3] = round(v_[3], read64(block + 24));
+}
+
+void Xxh64::update(const void* data, size_t len) {
+    auto p   = reinterpret_cast<const uint8_t*>(data);
+    auto end = p + len;
+
+    total_ += len;
+
+    if (buf_len_) {
+        size_t take = std::min(len, sizeof(buf_) - buf_len_);
+        ::memcpy(buf_ + buf_len_, p, take);
+        buf_len_ += take;
+        p        += take;
+        if (buf_len_ < sizeof(buf_))
+            return;
+        consume(buf_);
+        buf_len_ = 0;
+    }
+
+    for (; p + sizeof(buf_) <= end; p += sizeof(buf_))
+        consume(p);
+
+    buf_len_ = end - p;
+    ::memcpy(buf_, p, buf_len_);
+}
+
+void Xxh64::update_zeros(size_t len) {
+    while (len) {
+        size_t take = std::min(len, sizeof(zero_block));
+        update(zero_block, take);
+        len -= take;
+    }
+}
+
+uint64_t Xxh64::digest() const {
+    uint64_t h;
+
+    if (total_ >= sizeof(buf_)) {
+        h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+        h = merge_round(h, v_[0]);
+        h = merge_round(h, v_[1]);
+        h = merge_round(h, v_[2]);
+        h = merge_round(h, v_[3]);
+    } else {
+        h = seed_ + P5;
+    }
+
+    h += total_;
+
+    const uint8_t* p   = buf_;
+    const uint8_t* end = buf_ + buf_len_;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= round(0, read64(p));
+        h  = rotl(h, 27) * P1 + P4;
+    }
+
+    if (p + 4 <= end) {
+        h ^= uint64_t(read32(p)) * P1;
+        h  = rotl(h, 23) * P2 + P3;
+        p += 4;
+    }
+
+    for (; p < end; ++p) {
+        h ^= (*p) * P5;
+        h  = rotl(h, 11) * P1;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+StreamHash::StreamHash()
+    : lo_(0)
+    , hi_(P5)
+{
+}
+
+void StreamHash::update(const void* data, size_t len) {
+    lo_.update(data, len);
+    hi_.update(data, len);
+}
+
+void StreamHash::update_zeros(size_t len) {
+    lo_.update_zeros(len);
+    hi_.update_zeros(len);
+}
+
+void StreamHash::fill(void* out, size_t len) const {
+    auto dst = reinterpret_cast<uint8_t*>(out);
+
+    uint64_t words[2] = {lo_.digest(), hi_.digest()};
+    uint64_t state = words[0] ^ rotl(words[1], 32);
+
+    for (size_t i = 0; i < len; i += sizeof(uint64_t)) {
+        uint64_t w = (i / sizeof(uint64_t) < 2) ? words[i / sizeof(uint64_t)] : splitmix64(state);
+        uint8_t bytes[sizeof(uint64_t)];
+        for (size_t b = 0; b < sizeof(bytes); ++b)
+            bytes[b] = uint8_t(w >> (56 - 8 * b));
+        ::memcpy(dst + i, bytes, std::min(sizeof(bytes), len - i));
+    }
+}
+
+namespace {
+
+const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t rotr32(uint32_t x, int r) {
+    return (x >> r) | (x << (32 - r));
+}
+
+} // namespace
+
+Sha256::Sha256()
+    : state_{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19}
+    , total_(0)
+    , buf_{0}
+    , buf_len_(0)
+{
+}
+
+void Sha256::consume(const uint8_t* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+        w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16)
+             | (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+
+    for (int i = 0; i < 64; ++i) {
+        uint32_t s1  = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+        uint32_t ch  = (e & f) ^ (~e & g);
+        uint32_t t1  = h + s1 + ch + K256[i] + w[i];
+        uint32_t s0  = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2  = s0 + maj;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state_[0] += a; state_[1] += b; state_[2] += c; state_[3] += d;
+    state_[4] += e; state_[5] += f; state_[6] += g; state_[7] += h;
+}
+
+void Sha256::update(const void* data, size_t len) {
+    auto p   = reinterpret_cast<const uint8_t*>(data);
+    auto end = p + len;
+
+    total_ += len;
+
+    if (buf_len_) {
+        size_t take = std::min(len, sizeof(buf_) - buf_len_);
+        ::memcpy(buf_ + buf_len_, p, take);
+        buf_len_ += take;
+        p        += take;
+        if (buf_len_ < sizeof(buf_))
+            return;
+        consume(buf_);
+        buf_len_ = 0;
+    }
+
+    for (; p + sizeof(buf_) <= end; p += sizeof(buf_))
+        consume(p);
+
+    buf_len_ = end - p;
+    ::memcpy(buf_, p, buf_len_);
+}
+
+void Sha256::digest(uint8_t out[DIGEST_SIZE]) {
+    uint64_t bits = total_ * 8;
+
+    uint8_t pad[sizeof(buf_) + 8] = {0x80};
+    size_t pad_len = (buf_len_ < 56) ? (56 - buf_len_) : (120 - buf_len_);
+    update(pad, pad_len);
+
+    uint8_t len_be[8];
+    for (int i = 0; i < 8; ++i)
+        len_be[i] = uint8_t(bits >> (56 - 8 * i));
+    update(len_be, sizeof(len_be));
+
+    for (int i = 0; i < 8; ++i) {
+        out[i * 4]     = uint8_t(state_[i] >> 24);
+        out[i * 4 + 1] = uint8_t(state_[i] >> 16);
+        out[i * 4 + 2] = uint8_t(state_[i] >> 8);
+        out[i * 4 + 3] = uint8_t(state_[i]);
+    }
+}
+
+std::string Sha256::hex_digest() {
+    static const char hex[] = "0123456789abcdef";
+
+    uint8_t raw[DIGEST_SIZE];
+    digest(raw);
+
+    std::string out;
+    out.reserve(DIGEST_SIZE * 2);
+    for (auto b: raw) {
+        out.push_back(hex[b >> 4]);
+        out.push_back(hex[b & 0xf]);
+    }
+    return out;
+}
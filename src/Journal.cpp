@@ -0,0 +1,237 @@
+#include <safe_patchelf/Journal.h>
+#include <safe_patchelf/Hash.h>
+#include <safe_patchelf/Json.h>
+#include <safe_patchelf/FD.h>
+
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+
+namespace {
+
+const uint64_t VERSION = 1;
+
+const char* result_name(Journal::Result result) {
+    switch (result) {
+    case Journal::Ok:     return "ok";
+    case Journal::NotElf: return "not-elf";
+    case Journal::NoOp:   return "no-op";
+    default:              return "error";
+    }
+}
+
+std::optional<Journal::Result> result_of(const std::string& name) {
+    if (name == "ok")      return Journal::Ok;
+    if (name == "not-elf") return Journal::NotElf;
+    if (name == "error")   return Journal::Error;
+    if (name == "no-op")   return Journal::NoOp;
+    return std::nullopt;
+}
+
+uint64_t hash_of(const std::string& s) {
+    Xxh64 hash;
+    hash.update(s.c_str(), s.size() + 1);
+    return hash.digest();
+}
+
+} // namespace
+
+/*static*/ std::map<std::string, uint64_t> Journal::rules_of(const Args& args) {
+    std::map<std::string, uint64_t> rules;
+
+    if (!args.soname.empty())
+        rules["soname"] = hash_of(args.soname);
+    if (!args.interpreter.empty())
+        rules["interpreter"] = hash_of(args.interpreter);
+    if (args.update_build_id)
+        rules["build-id"] = 1;
+    std::for_each(args.neededs.begin(), args.neededs.end(), [&](auto& n) {
+        rules["needed:" + n.first] = hash_of(n.second);
+    });
+
+    return rules;
+}
+
+bool Journal::load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in)
+        return false;
+
+    std::string line;
+    if (!std::getline(in, line))
+        return false;
+
+    auto header = Json::parse(line);
+    auto version = header ? header->get("journal") : nullptr;
+    auto rules = header ? header->get("rules") : nullptr;
+    if (!version || version->as_u64() != VERSION || !rules || rules->type != Json::Value::Object)
+        return false;
+
+    std::for_each(rules->object.begin(), rules->object.end(), [this](auto& it) {
+        if (auto fp = it.second.as_u64())
+            loaded_rules_[it.first] = *fp;
+    });
+
+    // Broken or truncated lines are ignored, their paths get processed again
+    while (std::getline(in, line)) {
+        auto value = Json::parse(line);
+        if (!value || value->type != Json::Value::Object)
+            continue;
+
+        auto path   = value->get("path");
+        auto result = value->get("result");
+        auto dev    = value->get("dev");
+        auto ino    = value->get("ino");
+        auto size   = value->get("size");
+        auto mtime  = value->get("mtime_ns");
+        if (!path || !result || !dev || !ino || !size || !mtime
+            || !dev->as_u64() || !ino->as_u64() || !size->as_u64() || !mtime->as_u64()
+            || !result_of(result->string))
+            continue;
+
+        Record record;
+        record.key = ScanCache::Key{*dev->as_u64(), *ino->as_u64(), *size->as_u64(), *mtime->as_u64()};
+        record.result = *result_of(result->string);
+
+        if (auto soname = value->get("soname"))
+            record.soname = soname->string;
+        if (auto interp = value->get("interp"))
+            record.interp = interp->string;
+        if (auto needed = value->get("needed")) {
+            std::for_each(needed->array.begin(), needed->array.end(), [&](auto& n) {
+                record.needed.push_back(n.string);
+            });
+        }
+
+        records_[path->string] = std::move(record);
+    }
+
+    return true;
+}
+
+void Journal::begin(const Args& args) {
+    rules_ = rules_of(args);
+
+    // Removed rules need nothing, patched strings are not restored
+    std::for_each(rules_.begin(), rules_.end(), [this](auto& it) {
+        auto old = loaded_rules_.find(it.first);
+        if (old == loaded_rules_.end() || old->second != it.second)
+            changed_.push_back(it.first);
+    });
+
+    // New build-id depends on all of the content
+    changed_all_ = std::find(changed_.begin(), changed_.end(), "build-id") != changed_.end();
+}
+
+bool Journal::affected(const Record& record) const {
+    if (changed_all_)
+        return true;
+
+    return std::any_of(changed_.begin(), changed_.end(), [&record](auto& rule) {
+        if (rule == "soname")
+            return bool(record.soname);
+        if (rule == "interpreter")
+            return bool(record.interp);
+        auto old = rule.substr(rule.find(':') + 1);
+        return std::find(record.needed.begin(), record.needed.end(), old) != record.needed.end();
+    });
+}
+
+bool Journal::unchanged(const Walker::Entry& entry) const {
+    auto it = records_.find(entry.path);
+    if (it == records_.end())
+        return false;
+
+    auto& record = it->second;
+    auto key = ScanCache::Key::of(entry.st);
+    if (record.key.dev != key.dev || record.key.ino != key.ino
+        || record.key.size != key.size || record.key.mtime_ns != key.mtime_ns)
+        return false;
+
+    // Errors are reported again, explicitly named non ELF files too
+    if (record.result == Error || (record.result == NotElf && !entry.from_dir))
+        return false;
+
+    return record.result == NotElf || !affected(record);
+}
+
+void Journal::record(const std::string& path, const struct ::stat& st, Result result, const ElfSummary* summary) {
+    Record record;
+    record.key = ScanCache::Key::of(st);
+    record.result = result;
+    if (summary) {
+        record.soname = summary->soname;
+        record.needed = summary->needed;
+        record.interp = summary->interp;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    updates_[path] = std::move(record);
+}
+
+bool Journal::save(const std::string& path) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::map<std::string, const Record*> all;
+    std::for_each(records_.begin(), records_.end(), [&all](auto& it) { all[it.first] = &it.second; });
+    std::for_each(updates_.begin(), updates_.end(), [&all](auto& it) { all[it.first] = &it.second; });
+
+    // Write aside and rename, an interrupted run leaves the old journal and
+    // concurrent runs each write their own file
+    std::string tmp;
+    if (FD::temp_beside(path, tmp).bad())
+        return false;
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+
+        Json::Value header, rules;
+        rules.type = Json::Value::Object;
+        std::for_each(rules_.begin(), rules_.end(), [&rules](auto& it) {
+            rules.set(it.first, Json::Value::of(it.second));
+        });
+        header.type = Json::Value::Object;
+        header.set("journal", Json::Value::of(VERSION));
+        header.set("rules", std::move(rules));
+        Json::write(out, header);
+        out << "\n";
+
+        std::for_each(all.begin(), all.end(), [&out](auto& it) {
+            auto& record = *it.second;
+            out << "{\"path\":";
+            Json::quoted(out, it.first);
+            out << ",\"dev\":" << record.key.dev
+                << ",\"ino\":" << record.key.ino
+                << ",\"size\":" << record.key.size
+                << ",\"mtime_ns\":" << record.key.mtime_ns
+                << ",\"result\":\"" << result_name(record.result) << "\"";
+            if (record.soname) {
+                out << ",\"soname\":";
+                Json::quoted(out, *record.soname);
+            }
+            if (record.interp) {
+                out << ",\"interp\":";
+                Json::quoted(out, *record.interp);
+            }
+            if (!record.needed.empty()) {
+                out << ",\"needed\":[";
+                for (size_t i = 0; i < record.needed.size(); ++i) {
+                    out << (i ? "," : "");
+                    Json::quoted(out, record.needed[i]);
+                }
+                out << "]";
+            }
+            out << "}\n";
+        });
+
+        if (!out.flush()) {
+            ::unlink(tmp.c_str());
+            return false;
+        }
+    }
+
+    if (::rename(tmp.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,312 @@
+#include <safe_patchelf/Json.h>
+
+#include <algorithm>
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+/*static*/ std::string Json::escape(const std::string& s) {
+    static const char hex[] = "0123456789abcdef";
+
+    std::string out;
+    out.reserve(s.size());
+    for (unsigned char c: s) {
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\b': out += "\\b";  break;
+        case '\f': out += "\\f";  break;
+        case '\n': out += "\\n";  break;
+        case '\r': out += "\\r";  break;
+        case '\t': out += "\\t";  break;
+        default:
+            if (c < 0x20) {
+                out += "\\u00";
+                out.push_back(hex[c >> 4]);
+                out.push_back(hex[c & 0xf]);
+            } else {
+                out.push_back(c);
+            }
+        }
+    }
+    return out;
+}
+
+/*static*/ std::ostream& Json::quoted(std::ostream& out, const std::string& s) {
+    return out << '"' << escape(s) << '"';
+}
+
+/*static*/ Json::Value Json::Value::of(const std::string& s) {
+    Value v;
+    v.type   = String;
+    v.string = s;
+    return v;
+}
+
+/*static*/ Json::Value Json::Value::of(uint64_t n) {
+    Value v;
+    v.type   = Number;
+    v.string = std::to_string(n);
+    return v;
+}
+
+const Json::Value* Json::Value::get(const std::string& key) const {
+    auto it = std::find_if(object.begin(), object.end(), [&key](auto& m) { return m.first == key; });
+    return (it != object.end()) ? &it->second : nullptr;
+}
+
+Json::Value* Json::Value::get(const std::string& key) {
+    auto it = std::find_if(object.begin(), object.end(), [&key](auto& m) { return m.first == key; });
+    return (it != object.end()) ? &it->second : nullptr;
+}
+
+void Json::Value::set(const std::string& key, Value value) {
+    if (auto existing = get(key))
+        *existing = std::move(value);
+    else
+        object.push_back(std::make_pair(key, std::move(value)));
+}
+
+std::optional<uint64_t> Json::Value::as_u64() const {
+    if (type != Number || string.empty() || string.find_first_not_of("0123456789") != std::string::npos)
+        return std::nullopt;
+    return std::strtoull(string.c_str(), nullptr, 10);
+}
+
+namespace {
+
+class Parser {
+public:
+    explicit Parser(const std::string& text)
+        : p_(text.data())
+        , end_(text.data() + text.size())
+    {
+    }
+
+    std::optional<Json::Value> document() {
+        Json::Value v;
+        if (!value(v, 0))
+            return std::nullopt;
+        skip_ws();
+        if (p_ != end_)
+            return std::nullopt;
+        return v;
+    }
+
+private:
+    void skip_ws() {
+        while (p_ != end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r'))
+            ++p_;
+    }
+
+    bool literal(const char* word) {
+        size_t len = ::strlen(word);
+        if (size_t(end_ - p_) < len || ::strncmp(p_, word, len) != 0)
+            return false;
+        p_ += len;
+        return true;
+    }
+
+    static void put_utf8(std::string& out, uint32_t cp) {
+        if (cp < 0x80) {
+            out.push_back(char(cp));
+        } else if (cp < 0x800) {
+            out.push_back(char(0xc0 | (cp >> 6)));
+            out.push_back(char(0x80 | (cp & 0x3f)));
+        } else if (cp < 0x10000) {
+            out.push_back(char(0xe0 | (cp >> 12)));
+            out.push_back(char(0x80 | ((cp >> 6) & 0x3f)));
+            out.push_back(char(0x80 | (cp & 0x3f)));
+        } else {
+            out.push_back(char(0xf0 | (cp >> 18)));
+            out.push_back(char(0x80 | ((cp >> 12) & 0x3f)));
+            out.push_back(char(0x80 | ((cp >> 6) & 0x3f)));
+            out.push_back(char(0x80 | (cp & 0x3f)));
+        }
+    }
+
+    bool hex4(uint32_t& cp) {
+        if (end_ - p_ < 4)
+            return false;
+        cp = 0;
+        for (int i = 0; i < 4; ++i, ++p_) {
+            char c = *p_;
+            cp <<= 4;
+            if (c >= '0' && c <= '9')      cp |= c - '0';
+            else if (c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+            else return false;
+        }
+        return true;
+    }
+
+    bool string(std::string& out) {
+        if (p_ == end_ || *p_ != '"')
+            return false;
+        ++p_;
+        while (p_ != end_ && *p_ != '"') {
+            char c = *p_++;
+            if (c != '\\') {
+                out.push_back(c);
+                continue;
+            }
+            if (p_ == end_)
+                return false;
+            switch (*p_++) {
+            case '"':  out.push_back('"');  break;
+            case '\\': out.push_back('\\'); break;
+            case '/':  out.push_back('/');  break;
+            case 'b':  out.push_back('\b'); break;
+            case 'f':  out.push_back('\f'); break;
+            case 'n':  out.push_back('\n'); break;
+            case 'r':  out.push_back('\r'); break;
+            case 't':  out.push_back('\t'); break;
+            case 'u': {
+                uint32_t cp;
+                if (!hex4(cp))
+                    return false;
+                if (cp >= 0xd800 && cp < 0xdc00 && end_ - p_ >= 6 && p_[0] == '\\' && p_[1] == 'u') {
+                    p_ += 2;
+                    uint32_t lo;
+                    if (!hex4(lo))
+                        return false;
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                }
+                put_utf8(out, cp);
+            }
+            break;
+            default:
+                return false;
+            }
+        }
+        if (p_ == end_)
+            return false;
+        ++p_;
+        return true;
+    }
+
+    bool value(Json::Value& v, int depth) {
+        if (depth > 256)
+            return false;
+
+        skip_ws();
+        if (p_ == end_)
+            return false;
+
+        switch (*p_) {
+        case 'n':
+            v.type = Json::Value::Null;
+            return literal("null");
+        case 't':
+            v.type = Json::Value::Bool;
+            v.boolean = true;
+            return literal("true");
+        case 'f':
+            v.type = Json::Value::Bool;
+            return literal("false");
+        case '"':
+            v.type = Json::Value::String;
+            return string(v.string);
+        case '[':
+            v.type = Json::Value::Array;
+            ++p_;
+            skip_ws();
+            if (p_ != end_ && *p_ == ']') {
+                ++p_;
+                return true;
+            }
+            while (true) {
+                v.array.emplace_back();
+                if (!value(v.array.back(), depth + 1))
+                    return false;
+                skip_ws();
+                if (p_ == end_)
+                    return false;
+                if (*p_ == ']') {
+                    ++p_;
+                    return true;
+                }
+                if (*p_++ != ',')
+                    return false;
+            }
+        case '{':
+            v.type = Json::Value::Object;
+            ++p_;
+            skip_ws();
+            if (p_ != end_ && *p_ == '}') {
+                ++p_;
+                return true;
+            }
+            while (true) {
+                skip_ws();
+                std::string key;
+                if (!string(key))
+                    return false;
+                skip_ws();
+                if (p_ == end_ || *p_++ != ':')
+                    return false;
+                v.object.emplace_back(std::move(key), Json::Value());
+                if (!value(v.object.back().second, depth + 1))
+                    return false;
+                skip_ws();
+                if (p_ == end_)
+                    return false;
+                if (*p_ == '}') {
+                    ++p_;
+                    return true;
+                }
+                if (*p_++ != ',')
+                    return false;
+            }
+        default: {
+            auto start = p_;
+            while (p_ != end_ && (::isdigit(*p_) || *p_ == '-' || *p_ == '+' || *p_ == '.' || *p_ == 'e' || *p_ == 'E'))
+                ++p_;
+            if (p_ == start)
+                return false;
+            v.type = Json::Value::Number;
+            v.string.assign(start, p_);
+            return true;
+        }
+        }
+    }
+
+    const char* p_;
+    const char* end_;
+};
+
+} // namespace
+
+/*static*/ std::optional<Json::Value> Json::parse(const std::string& text) {
+    return Parser(text).document();
+}
+
+/*static*/ void Json::write(std::ostream& out, const Value& value) {
+    switch (value.type) {
+    case Value::Null:   out << "null"; break;
+    case Value::Bool:   out << (value.boolean ? "true" : "false"); break;
+    case Value::Number: out << value.string; break;
+    case Value::String: quoted(out, value.string); break;
+    case Value::Array:
+        out << "[";
+        for (size_t i = 0; i < value.array.size(); ++i) {
+            if (i)
+                out << ",";
+            write(out, value.array[i]);
+        }
+        out << "]";
+        break;
+    case Value::Object:
+        out << "{";
+        for (size_t i = 0; i < value.object.size(); ++i) {
+            if (i)
+                out << ",";
+            quoted(out, value.object[i].first);
+            out << ":";
+            write(out, value.object[i].second);
+        }
+        out << "}";
+        break;
+    }
+}
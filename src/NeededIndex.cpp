@@ -0,0 +1,367 @@
+#include <safe_patchelf/NeededIndex.h>
+#include <safe_patchelf/Batch.h>
+#include <safe_patchelf/Query.h>
+#include <safe_patchelf/Scheduler.h>
+#include <safe_patchelf/Walker.h>
+#include <safe_patchelf/Json.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <unordered_set>
+
+namespace {
+
+const char     MAGIC[8] = {'S', 'P', 'E', 'I', 'N', 'D', 'E', 'X'};
+const uint32_t VERSION  = 1;
+
+bool same(const ScanCache::Key& a, const ScanCache::Key& b) {
+    return a.dev == b.dev && a.ino == b.ino && a.size == b.size && a.mtime_ns == b.mtime_ns;
+}
+
+void emit_needs(const std::string& file, const std::string& soname, std::ostream& out) {
+    out << "{\"file\":";
+    Json::quoted(out, file);
+    out << ",\"needed\":";
+    Json::quoted(out, soname);
+    out << "}" << std::endl;
+}
+
+} // namespace
+
+/*static*/ bool NeededIndex::under(const std::string& path, const std::vector<std::string>& roots) {
+    if (roots.empty())
+        return true;
+
+    return std::any_of(roots.begin(), roots.end(), [&path](std::string root) {
+        while (root.size() > 1 && root.back() == '/')
+            root.pop_back();
+        return path == root
+            || (path.size() > root.size() && path.compare(0, root.size(), root) == 0
+                && (path[root.size()] == '/' || root.back() == '/'));
+    });
+}
+
+bool NeededIndex::load(const std::string& path) {
+    FD fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.bad())
+        return false;
+
+    size_t size = fd.size();
+    if (size < sizeof(Header))
+        return false;
+
+    auto content = reinterpret_cast<const char*>(fd.mmap(0, 0, PROT_READ, MAP_FILE | MAP_PRIVATE));
+    if (!content)
+        return false;
+
+    auto h = reinterpret_cast<const Header*>(content);
+    auto table_fits = [size](uint64_t off, uint64_t count, size_t item) {
+        return off <= size && count <= (size - off) / item;
+    };
+
+    if (::memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0
+        || h->version != VERSION
+        || !table_fits(h->files_off, h->file_count, sizeof(FileRecord))
+        || !table_fits(h->names_off, h->name_count, sizeof(NameRecord))
+        || !table_fits(h->needs_off, h->needs_count, sizeof(uint32_t))
+        || !table_fits(h->postings_off, h->postings_count, sizeof(uint32_t))
+        || !table_fits(h->strings_off, h->strings_size, 1))
+        return false;
+
+    fd_     = std::move(fd);
+    header_ = h;
+    base_   = content;
+
+    return true;
+}
+
+std::string NeededIndex::string_at(uint64_t off, uint32_t len) const {
+    if (off > header_->strings_size || len > header_->strings_size - off)
+        return std::string();
+    return std::string(base_ + header_->strings_off + off, len);
+}
+
+std::vector<std::string> NeededIndex::who_needs(const std::string& soname, const std::vector<std::string>& roots) const {
+    std::vector<std::string> result;
+
+    if (decoded_) {
+        std::for_each(files_.begin(), files_.end(), [&](auto& it) {
+            auto& needed = it.second.needed;
+            if (std::find(needed.begin(), needed.end(), soname) != needed.end() && under(it.first, roots))
+                result.push_back(it.first);
+        });
+        return result;
+    }
+
+    if (!header_)
+        return result;
+
+    auto names    = reinterpret_cast<const NameRecord*>(base_ + header_->names_off);
+    auto files    = reinterpret_cast<const FileRecord*>(base_ + header_->files_off);
+    auto postings = reinterpret_cast<const uint32_t*>(base_ + header_->postings_off);
+
+    // Names are sorted, binary search in place
+    size_t lo = 0, hi = header_->name_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (string_at(names[mid].str_off, names[mid].str_len) < soname)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == header_->name_count || string_at(names[lo].str_off, names[lo].str_len) != soname)
+        return result;
+
+    auto& name = names[lo];
+    if (name.posting_first > header_->postings_count || name.posting_count > header_->postings_count - name.posting_first)
+        return result;
+
+    for (uint64_t i = name.posting_first; i < name.posting_first + name.posting_count; ++i) {
+        if (postings[i] >= header_->file_count)
+            continue;
+        auto& file = files[postings[i]];
+        auto path = string_at(file.path_off, file.path_len);
+        if (under(path, roots))
+            result.push_back(std::move(path));
+    }
+
+    return result;
+}
+
+void NeededIndex::decode() {
+    if (decoded_)
+        return;
+    decoded_ = true;
+
+    if (!header_)
+        return;
+
+    auto files = reinterpret_cast<const FileRecord*>(base_ + header_->files_off);
+    auto names = reinterpret_cast<const NameRecord*>(base_ + header_->names_off);
+    auto needs = reinterpret_cast<const uint32_t*>(base_ + header_->needs_off);
+
+    for (uint64_t i = 0; i < header_->file_count; ++i) {
+        auto& rec = files[i];
+
+        File file;
+        file.key = rec.key;
+        file.elf = rec.elf != 0;
+        if (rec.needs_first <= header_->needs_count && rec.needs_count <= header_->needs_count - rec.needs_first) {
+            for (uint32_t n = rec.needs_first; n < rec.needs_first + rec.needs_count; ++n) {
+                if (needs[n] < header_->name_count)
+                    file.needed.push_back(string_at(names[needs[n]].str_off, names[needs[n]].str_len));
+            }
+        }
+
+        files_[string_at(rec.path_off, rec.path_len)] = std::move(file);
+    }
+}
+
+NeededIndex::Stats NeededIndex::update(const std::vector<std::string>& roots, unsigned jobs, std::ostream& err) {
+    decode();
+
+    Stats stats;
+
+    auto entries = Walker::collect(roots, err, false, &stats.failed);
+
+    // Only files whose identity changed are read again
+    std::vector<const Walker::Entry*> changed;
+    std::unordered_set<std::string> seen;
+    std::for_each(entries.begin(), entries.end(), [&](auto& entry) {
+        seen.insert(entry.path);
+        auto it = files_.find(entry.path);
+        if (it == files_.end() || !same(it->second.key, ScanCache::Key::of(entry.st)))
+            changed.push_back(&entry);
+    });
+
+    std::vector<File> scanned(changed.size());
+    Scheduler::run(changed.size(), jobs, [&](size_t i) {
+        auto& entry = *changed[i];
+        std::string error;
+        auto summary = Query::query_file(entry.path, error);
+
+        scanned[i].key = ScanCache::Key::of(entry.st);
+        scanned[i].elf = bool(summary);
+        if (summary)
+            scanned[i].needed = std::move(summary->needed);
+    });
+
+    for (size_t i = 0; i < changed.size(); ++i)
+        files_[changed[i]->path] = std::move(scanned[i]);
+
+    for (auto it = files_.begin(); it != files_.end();) {
+        if (!stats.failed && !seen.count(it->first) && under(it->first, roots)) {
+            it = files_.erase(it);
+            ++stats.removed;
+        } else {
+            ++it;
+        }
+    }
+
+    stats.files = files_.size();
+    stats.rescanned = changed.size();
+
+    return stats;
+}
+
+bool NeededIndex::save(const std::string& path) const {
+    std::string strings;
+    std::vector<FileRecord> files;
+    std::vector<uint32_t> needs;
+
+    // Name ids in sorted order, file ids in path order
+    std::map<std::string, std::vector<uint32_t> > postings_of;
+    std::for_each(files_.begin(), files_.end(), [&](auto& it) {
+        std::for_each(it.second.needed.begin(), it.second.needed.end(), [&](auto& n) {
+            auto& postings = postings_of[n];
+            if (postings.empty() || postings.back() != files.size())
+                postings.push_back(files.size());
+        });
+        files.emplace_back();
+    });
+
+    std::map<std::string, uint32_t> name_ids;
+    std::vector<NameRecord> names;
+    std::vector<uint32_t> postings;
+    std::for_each(postings_of.begin(), postings_of.end(), [&](auto& it) {
+        name_ids[it.first] = names.size();
+        names.push_back(NameRecord{strings.size(), uint32_t(it.first.size()), uint32_t(it.second.size()), postings.size()});
+        strings += it.first;
+        postings.insert(postings.end(), it.second.begin(), it.second.end());
+    });
+
+    size_t i = 0;
+    std::for_each(files_.begin(), files_.end(), [&](auto& it) {
+        auto& rec = files[i++];
+        rec.key = it.second.key;
+        rec.path_off = strings.size();
+        rec.path_len = it.first.size();
+        rec.elf = it.second.elf;
+        rec.needs_first = needs.size();
+        rec.needs_count = it.second.needed.size();
+        strings += it.first;
+        std::for_each(it.second.needed.begin(), it.second.needed.end(), [&](auto& n) { needs.push_back(name_ids[n]); });
+    });
+
+    Header header{};
+    ::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version        = VERSION;
+    header.file_count     = files.size();
+    header.name_count     = names.size();
+    header.needs_count    = needs.size();
+    header.postings_count = postings.size();
+    header.files_off      = sizeof(Header);
+    header.names_off      = header.files_off + files.size() * sizeof(FileRecord);
+    header.needs_off      = header.names_off + names.size() * sizeof(NameRecord);
+    header.postings_off   = header.needs_off + needs.size() * sizeof(uint32_t);
+    header.strings_off    = header.postings_off + postings.size() * sizeof(uint32_t);
+    header.strings_size   = strings.size();
+
+    // Write aside and rename, readers never see a partial file
+    std::string tmp;
+    if (FD::temp_beside(path, tmp).bad())
+        return false;
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(files.data()), files.size() * sizeof(FileRecord));
+        out.write(reinterpret_cast<const char*>(names.data()), names.size() * sizeof(NameRecord));
+        out.write(reinterpret_cast<const char*>(needs.data()), needs.size() * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char*>(postings.data()), postings.size() * sizeof(uint32_t));
+        out.write(strings.data(), strings.size());
+        if (!out) {
+            ::unlink(tmp.c_str());
+            return false;
+        }
+    }
+
+    if (::rename(tmp.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*static*/ int NeededIndex::run(const Args& args) {
+    NeededIndex index;
+    bool loaded = index.load(args.index);
+
+    // Plain lookup: no walk at all
+    if (!args.who_needs.empty() && args.filenames.empty()) {
+        if (!loaded) {
+            std::cerr << "error: Can't load index " << args.index << "!" << std::endl;
+            return -1;
+        }
+        auto files = index.who_needs(args.who_needs);
+        std::for_each(files.begin(), files.end(), [&](auto& f) { emit_needs(f, args.who_needs, std::cout); });
+        return 0;
+    }
+
+    auto stats = index.update(args.filenames, args.jobs);
+
+    if (!args.who_needs.empty()) {
+        auto files = index.who_needs(args.who_needs, args.filenames);
+        std::for_each(files.begin(), files.end(), [&](auto& f) { emit_needs(f, args.who_needs, std::cout); });
+    } else {
+        std::cout << "{\"summary\":{\"files\":" << stats.files
+                  << ",\"rescanned\":" << stats.rescanned
+                  << ",\"removed\":" << stats.removed << "}}" << std::endl;
+    }
+
+    if ((stats.rescanned || stats.removed || !loaded) && !index.save(args.index)) {
+        std::cerr << "error: Can't write index " << args.index << "!" << std::endl;
+        return -1;
+    }
+
+    return stats.failed ? -1 : 0;
+}
+
+/*static*/ int NeededIndex::patch(const Args& args) {
+    if (args.neededs.empty()) {
+        std::cerr << "error: Index selects files by needed replacements only!" << std::endl;
+        return -1;
+    }
+
+    NeededIndex index;
+    if (!index.load(args.index) && args.filenames.empty()) {
+        std::cerr << "error: Can't load index " << args.index << "!" << std::endl;
+        return -1;
+    }
+
+    bool failed = !args.filenames.empty() && index.update(args.filenames, args.jobs).failed;
+
+    std::vector<std::string> targets;
+    std::for_each(args.neededs.begin(), args.neededs.end(), [&](auto& n) {
+        auto files = index.who_needs(n.first, args.filenames);
+        targets.insert(targets.end(), files.begin(), files.end());
+    });
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+    if (targets.empty()) {
+        std::cerr << "error: No indexed file needs any of the replaced names!" << std::endl;
+        return -1;
+    }
+
+    Args batch(args);
+    batch.filenames = targets;
+    batch.index.clear();
+
+    int ret = Batch::run(batch);
+    if (failed)
+        ret = -1;
+
+    // Patched files have new identities and DT_NEEDED strings
+    index.update(targets, args.jobs);
+    if (!index.save(args.index)) {
+        std::cerr << "error: Can't write index " << args.index << "!" << std::endl;
+        ret = -1;
+    }
+
+    return ret;
+}
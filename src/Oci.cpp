@@ -0,0 +1,404 @@
+#include <safe_patchelf/Oci.h>
+#include <safe_patchelf/Tar.h>
+#include <safe_patchelf/Json.h>
+#include <safe_patchelf/Hash.h>
+#include <safe_patchelf/Scheduler.h>
+#include <safe_patchelf/FD.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <optional>
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+
+const char* const INDEX_TYPES[] = {
+    "application/vnd.oci.image.index.v1+json",
+    "application/vnd.docker.distribution.manifest.list.v2+json",
+};
+
+const char* const MANIFEST_TYPES[] = {
+    "application/vnd.oci.image.manifest.v1+json",
+    "application/vnd.docker.distribution.manifest.v2+json",
+};
+
+const int MAX_DEPTH = 8;
+
+struct Layer {
+    std::string digest;
+    std::string path;
+
+    // Patch result, messages prefixed with their member names
+    int ret = 0;
+    bool changed = false;
+    std::string messages;
+    std::string new_digest;
+    uint64_t new_size = 0;
+    std::string diff_id;
+    Tar::Stats stats;
+};
+
+std::optional<std::string> read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return std::nullopt;
+    std::ostringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+// Write aside under a unique name and rename, readers never see a
+// partial file and concurrent runs don't share one
+bool write_file(const std::string& path, const std::string& content) {
+    std::string tmp;
+    FD out = FD::temp_beside(path, tmp);
+    if (out.bad())
+        return false;
+
+    if (!Tar::write_full(out.get(), content.data(), content.size()) || ::rename(tmp.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string type_of(const Json::Value& desc) {
+    auto type = desc.get("mediaType");
+    return (type && type->type == Json::Value::String) ? type->string : std::string();
+}
+
+bool is_one_of(const std::string& type, const char* const (&types)[2]) {
+    return std::any_of(std::begin(types), std::end(types), [&type](auto t) { return type == t; });
+}
+
+class Layout {
+public:
+    Layout(const std::string& dir, const Args& args, std::ostream& err)
+        : dir_(dir)
+        , args_(args)
+        , err_(err)
+    {
+    }
+
+    // blobs/<algorithm>/<hex>, only sha256 digests are accepted
+    std::optional<std::string> blob_path(const Json::Value& desc) const {
+        auto digest = desc.get("digest");
+        if (!digest || digest->type != Json::Value::String)
+            return std::nullopt;
+        return blob_path(digest->string);
+    }
+
+    std::optional<std::string> blob_path(const std::string& digest) const {
+        if (digest.size() != 7 + 64 || digest.compare(0, 7, "sha256:") != 0
+            || digest.find_first_not_of("0123456789abcdef", 7) != std::string::npos)
+            return std::nullopt;
+        return dir_ + "/blobs/sha256/" + digest.substr(7);
+    }
+
+    std::optional<Json::Value> read_json(const Json::Value& desc) const {
+        auto path = blob_path(desc);
+        if (!path) {
+            err_ << "error: " << dir_ << ": Bad descriptor digest!" << std::endl;
+            return std::nullopt;
+        }
+        auto text = read_file(*path);
+        auto value = text ? Json::parse(*text) : std::nullopt;
+        if (!value || value->type != Json::Value::Object) {
+            err_ << "error: Can't read " << *path << "!" << std::endl;
+            return std::nullopt;
+        }
+        return value;
+    }
+
+    // New blob with the document, desc is pointed to it
+    bool write_json(Json::Value& desc, const Json::Value& value) const {
+        std::ostringstream text;
+        Json::write(text, value);
+        std::string content = text.str();
+
+        Sha256 sha;
+        sha.update(content.data(), content.size());
+        std::string digest = "sha256:" + sha.hex_digest();
+
+        if (!write_file(*blob_path(digest), content)) {
+            err_ << "error: Can't write blob " << digest << "!" << std::endl;
+            return false;
+        }
+
+        desc.set("digest", Json::Value::of(digest));
+        desc.set("size", Json::Value::of(uint64_t(content.size())));
+        return true;
+    }
+
+    // Index type by media type, or by content when not given
+    bool is_index(const Json::Value& desc, const Json::Value& doc) const {
+        auto type = type_of(desc);
+        return is_one_of(type, INDEX_TYPES) || (type.empty() && doc.get("manifests"));
+    }
+
+    bool is_manifest(const Json::Value& desc, const Json::Value& doc) const {
+        auto type = type_of(desc);
+        return is_one_of(type, MANIFEST_TYPES) || (type.empty() && doc.get("layers"));
+    }
+
+    // Tar layers reachable from desc
+    bool collect(const Json::Value& desc, int depth) {
+        if (depth > MAX_DEPTH) {
+            err_ << "error: " << dir_ << ": Indexes nested too deep!" << std::endl;
+            return false;
+        }
+
+        auto type = type_of(desc);
+        if (!type.empty() && !is_one_of(type, INDEX_TYPES) && !is_one_of(type, MANIFEST_TYPES))
+            return true;
+
+        auto doc = read_json(desc);
+        if (!doc)
+            return false;
+
+        if (is_index(desc, *doc))
+            return for_each_descriptor(*doc, "manifests", [&](auto& d) { return collect(d, depth + 1); });
+
+        if (!is_manifest(desc, *doc))
+            return true;
+
+        return for_each_descriptor(*doc, "layers", [&](auto& d) {
+            if (type_of(d).find("tar") == std::string::npos)
+                return true;
+            auto path = blob_path(d);
+            if (!path) {
+                err_ << "error: " << dir_ << ": Bad layer digest!" << std::endl;
+                return false;
+            }
+            auto digest = d.get("digest")->string;
+            if (!layer_by_digest_.count(digest)) {
+                layer_by_digest_[digest] = layers_.size();
+                layers_.emplace_back();
+                layers_.back().digest = digest;
+                layers_.back().path   = *path;
+            }
+            return true;
+        });
+    }
+
+    void patch_layers() {
+        unsigned jobs = args_.jobs ? args_.jobs : Scheduler::default_jobs();
+        Scheduler::run(layers_.size(), jobs, [&](size_t i) { patch_layer(layers_[i]); });
+    }
+
+    // Points desc to new blobs when layers below changed, nullopt on errors
+    std::optional<bool> update(Json::Value& desc, int depth) {
+        auto type = type_of(desc);
+        if (depth > MAX_DEPTH || (!type.empty() && !is_one_of(type, INDEX_TYPES) && !is_one_of(type, MANIFEST_TYPES)))
+            return false;
+
+        auto doc = read_json(desc);
+        if (!doc)
+            return std::nullopt;
+
+        bool changed = false;
+
+        if (is_index(desc, *doc)) {
+            bool ok = for_each_descriptor(*doc, "manifests", [&](auto& d) {
+                auto updated = update(d, depth + 1);
+                changed |= updated.value_or(false);
+                return bool(updated);
+            });
+            if (!ok)
+                return std::nullopt;
+        } else if (is_manifest(desc, *doc)) {
+            std::vector<std::pair<size_t, const Layer*> > changed_layers;
+            size_t position = 0;
+            for_each_descriptor(*doc, "layers", [&](auto& d) {
+                auto digest = d.get("digest");
+                auto it = digest ? layer_by_digest_.find(digest->string) : layer_by_digest_.end();
+                if (it != layer_by_digest_.end() && layers_[it->second].changed) {
+                    auto& layer = layers_[it->second];
+                    d.set("digest", Json::Value::of(layer.new_digest));
+                    d.set("size", Json::Value::of(layer.new_size));
+                    changed_layers.emplace_back(position, &layer);
+                }
+                ++position;
+                return true;
+            });
+
+            if (changed_layers.empty())
+                return false;
+
+            // diff_ids are the uncompressed layer digests, in layer order
+            auto config_desc = doc->get("config");
+            auto config = config_desc ? read_json(*config_desc) : std::nullopt;
+            auto rootfs = config ? config->get("rootfs") : nullptr;
+            auto diff_ids = rootfs ? rootfs->get("diff_ids") : nullptr;
+            if (!diff_ids || diff_ids->type != Json::Value::Array || diff_ids->array.size() != position) {
+                err_ << "error: " << dir_ << ": Image config without matching rootfs.diff_ids!" << std::endl;
+                return std::nullopt;
+            }
+            std::for_each(changed_layers.begin(), changed_layers.end(), [&](auto& it) {
+                diff_ids->array[it.first] = Json::Value::of(it.second->diff_id);
+            });
+
+            if (!write_json(*config_desc, *config))
+                return std::nullopt;
+            changed = true;
+        }
+
+        if (changed && !write_json(desc, *doc))
+            return std::nullopt;
+
+        return changed;
+    }
+
+    const std::vector<Layer>& layers() const { return layers_; }
+
+private:
+    template<class Fn>
+    static bool for_each_descriptor(Json::Value& doc, const std::string& key, Fn fn) {
+        auto list = doc.get(key);
+        if (!list || list->type != Json::Value::Array)
+            return true;
+        return std::all_of(list->array.begin(), list->array.end(), [&fn](auto& d) {
+            return d.type != Json::Value::Object || fn(d);
+        });
+    }
+
+    // Through the tar stream into a new blob, named after its digest
+    // once known. Members failing to patch stay unchanged in it, the
+    // others are kept; dropped when nothing was patched or the stream
+    // broke off.
+    void patch_layer(Layer& layer) {
+        std::ostringstream err;
+        layer.ret = patch_layer(layer, err);
+        layer.messages = err.str();
+    }
+
+    int patch_layer(Layer& layer, std::ostream& err) {
+        FD in(::open(layer.path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (in.bad()) {
+            err << "error: Can't open " << layer.path << "!" << std::endl;
+            return -1;
+        }
+
+        std::string tmp;
+        FD out = FD::temp_beside(layer.path, tmp);
+        if (out.bad()) {
+            err << "error: Can't create " << tmp << "!" << std::endl;
+            return -1;
+        }
+
+        Tar::Digests digests;
+        int ret = Tar::stream(in.get(), out.get(), args_, err, &layer.stats, &digests);
+        out.close();
+
+        if (!layer.stats.complete || layer.stats.changed == 0) {
+            ::unlink(tmp.c_str());
+            return ret;
+        }
+
+        layer.new_digest = "sha256:" + digests.compressed;
+        layer.new_size   = digests.size;
+        layer.diff_id    = "sha256:" + digests.uncompressed;
+
+        if (::rename(tmp.c_str(), blob_path(layer.new_digest)->c_str()) != 0) {
+            err << "error: Can't rename " << tmp << "!" << std::endl;
+            ::unlink(tmp.c_str());
+            return -1;
+        }
+        layer.changed = true;
+
+        return ret;
+    }
+
+    std::string dir_;
+    const Args& args_;
+    std::ostream& err_;
+
+    std::vector<Layer> layers_;
+    std::unordered_map<std::string, size_t> layer_by_digest_;
+};
+
+} // namespace
+
+/*static*/ int Oci::patch(const std::string& layout, const Args& args, std::ostream& out, std::ostream& err) {
+    std::string index_path = layout + "/index.json";
+
+    auto text = read_file(index_path);
+    auto index = text ? Json::parse(*text) : std::nullopt;
+    auto manifests = index ? index->get("manifests") : nullptr;
+    if (!manifests || manifests->type != Json::Value::Array) {
+        err << "error: " << layout << ": Not an OCI image layout!" << std::endl;
+        return -1;
+    }
+
+    Layout dir(layout, args, err);
+
+    bool ok = std::all_of(manifests->array.begin(), manifests->array.end(), [&](auto& desc) {
+        return dir.collect(desc, 0);
+    });
+    if (!ok)
+        return -1;
+
+    dir.patch_layers();
+
+    int ret = 0;
+    size_t changed = 0, failed = 0;
+    std::for_each(dir.layers().begin(), dir.layers().end(), [&](auto& layer) {
+        std::istringstream messages(layer.messages);
+        std::string line;
+        while (std::getline(messages, line))
+            err << layout << ": layer " << layer.digest << ": " << line << std::endl;
+
+        if (layer.ret != 0) {
+            ret = -1;
+            ++failed;
+        }
+        if (layer.changed) {
+            ++changed;
+            out << "oci: " << layout << ": layer " << layer.digest << " -> " << layer.new_digest
+                << " (" << layer.stats.changed << " ELF patched, " << layer.stats.failed << " failed)" << std::endl;
+        }
+    });
+
+    out << "oci: " << layout << ": " << dir.layers().size() << " layers, " << changed << " patched, "
+        << failed << " failed" << std::endl;
+
+    if (changed == 0)
+        return ret;
+
+    bool index_changed = false;
+    ok = std::all_of(manifests->array.begin(), manifests->array.end(), [&](auto& desc) {
+        auto updated = dir.update(desc, 0);
+        index_changed |= updated.value_or(false);
+        return bool(updated);
+    });
+    if (!ok)
+        return -1;
+
+    if (index_changed) {
+        std::ostringstream new_index;
+        Json::write(new_index, *index);
+        if (!write_file(index_path, new_index.str())) {
+            err << "error: Can't write " << index_path << "!" << std::endl;
+            return -1;
+        }
+    }
+
+    return ret;
+}
+
+/*static*/ int Oci::run(const Args& args) {
+    int ret = 0;
+
+    std::for_each(args.filenames.begin(), args.filenames.end(), [&](auto& layout) {
+        if (patch(layout, args, std::cout, std::cerr) != 0)
+            ret = -1;
+    });
+
+    return ret;
+}
@@ -0,0 +1,179 @@
+#include <safe_patchelf/Pipe.h>
+#include <safe_patchelf/Batch.h>
+#include <safe_patchelf/Dispatch.h>
+#include <safe_patchelf/Tar.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <cerrno>
+#include <algorithm>
+
+namespace {
+
+const size_t INITIAL_SIZE = 1 << 20;
+const size_t SPLICE_SIZE  = 1 << 20;
+
+// Whole content of a file descriptor in memory
+class Input {
+public:
+    Input() = default;
+
+    ~Input() {
+        if (data_)
+            ::munmap(data_, capacity_);
+    }
+
+    bool load(int fd) {
+        struct ::stat st;
+        if (::fstat(fd, &st) != 0)
+            return false;
+
+        if (S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* p = ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+                return false;
+            data_     = reinterpret_cast<char*>(p);
+            size_     = st.st_size;
+            capacity_ = st.st_size;
+            file_     = true;
+            return true;
+        }
+
+        capacity_ = INITIAL_SIZE;
+        void* p = ::mmap(nullptr, capacity_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            capacity_ = 0;
+            return false;
+        }
+        data_ = reinterpret_cast<char*>(p);
+
+        while (true) {
+            if (size_ == capacity_) {
+                // Pages are moved, not copied
+                p = ::mremap(data_, capacity_, capacity_ * 2, MREMAP_MAYMOVE);
+                if (p == MAP_FAILED)
+                    return false;
+                data_ = reinterpret_cast<char*>(p);
+                capacity_ *= 2;
+            }
+            ssize_t n = ::read(fd, data_ + size_, capacity_ - size_);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                return false;
+            if (n == 0)
+                return true;
+            size_ += n;
+        }
+    }
+
+    char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    // Content is the mapped regular file, unchanged bytes can be read
+    // from the descriptor again
+    bool file() const { return file_; }
+
+private:
+    char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+    bool file_ = false;
+};
+
+class Output {
+public:
+    Output(int in, const Input& input, int out)
+        : in_(in)
+        , input_(input)
+        , out_(out)
+    {
+        struct ::stat st;
+        if (::fstat(out, &st) == 0) {
+            pipe_ = S_ISFIFO(st.st_mode);
+            regular_ = S_ISREG(st.st_mode);
+        }
+    }
+
+    // Unchanged bytes: from the input file through the kernel, or the
+    // buffer pages themselves into a pipe
+    bool unchanged(size_t off, size_t len) {
+        while (len) {
+            ssize_t n = 0;      // no kernel copy between these two
+            if (input_.file()) {
+                loff_t in_off = off;
+                if (pipe_)
+                    n = ::splice(in_, &in_off, out_, nullptr, std::min(len, SPLICE_SIZE), SPLICE_F_MOVE);
+                else if (regular_)
+                    n = ::copy_file_range(in_, &in_off, out_, nullptr, std::min(len, SPLICE_SIZE), 0);
+            } else if (pipe_) {
+                struct iovec iov = { input_.data() + off, std::min(len, SPLICE_SIZE) };
+                n = ::vmsplice(out_, &iov, 1, 0);
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EPIPE)
+                return false;
+            if (n <= 0)
+                return Tar::write_full(out_, input_.data() + off, len);
+            off += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    bool modified(size_t off, size_t len) {
+        return Tar::write_full(out_, input_.data() + off, len);
+    }
+
+private:
+    int in_;
+    const Input& input_;
+    int out_;
+    bool pipe_ = false;
+    bool regular_ = false;
+};
+
+} // namespace
+
+/*static*/ int Pipe::run(const Args& args) {
+    ::signal(SIGPIPE, SIG_IGN);
+
+    Input input;
+    if (!input.load(STDIN_FILENO)) {
+        std::cerr << "error: Can't read stdin!" << std::endl;
+        return -1;
+    }
+
+    if (input.size() < EI_NIDENT || elf_class(input.data()).first == None) {
+        std::cerr << "error: stdin: Not an ELF file!" << std::endl;
+        return -1;
+    }
+
+    Batch::Ranges ranges;
+    int ret = Batch::patch_buffer(input.data(), input.size(), args, "stdin: ", std::cerr, std::cerr, nullptr, &ranges, true);
+    if (ret != 0)
+        return ret;
+
+    Output output(STDIN_FILENO, input, STDOUT_FILENO);
+
+    bool ok = true;
+    size_t pos = 0;
+    std::for_each(ranges.begin(), ranges.end(), [&](auto& r) {
+        ok = ok && output.unchanged(pos, r.first - pos) && output.modified(r.first, r.second);
+        pos = r.first + r.second;
+    });
+    ok = ok && output.unchanged(pos, input.size() - pos);
+
+    if (!ok) {
+        std::cerr << "error: Can't write stdout!" << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,213 @@
+#include <safe_patchelf/Plan.h>
+#include <safe_patchelf/FD.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+namespace {
+
+const char     MAGIC[8] = {'S', 'P', 'E', 'P', 'L', 'A', 'N', '\0'};
+const uint32_t VERSION  = 1;
+
+// Bounds checked reader over the loaded plan file
+class Reader {
+public:
+    Reader(const char* p, const char* end)
+        : p_(p)
+        , end_(end)
+    {
+    }
+
+    template<typename T>
+    bool get(T& value) {
+        if (size_t(end_ - p_) < sizeof(T))
+            return false;
+        ::memcpy(&value, p_, sizeof(T));
+        p_ += sizeof(T);
+        return true;
+    }
+
+    bool get(std::string& value, size_t len) {
+        if (size_t(end_ - p_) < len)
+            return false;
+        value.assign(p_, len);
+        p_ += len;
+        return true;
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+};
+
+template<typename T>
+void put(std::ostream& out, T value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+} // namespace
+
+/*static*/ std::string Plan::sha256(const char* content, size_t size) {
+    Sha256 sha;
+    sha.update(content, size);
+
+    std::string digest(Sha256::DIGEST_SIZE, '\0');
+    sha.digest(reinterpret_cast<uint8_t*>(&digest[0]));
+    return digest;
+}
+
+bool Plan::load(const std::string& path) {
+    FD fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.bad())
+        return false;
+
+    size_t size = fd.size();
+    auto content = size ? reinterpret_cast<const char*>(fd.mmap(0, 0, PROT_READ, MAP_FILE | MAP_PRIVATE)) : nullptr;
+    if (!content)
+        return false;
+
+    Reader in(content, content + size);
+
+    std::string magic;
+    uint32_t version = 0;
+    uint64_t count = 0;
+    if (!in.get(magic, sizeof(MAGIC)) || ::memcmp(magic.data(), MAGIC, sizeof(MAGIC)) != 0
+        || !in.get(version) || version != VERSION || !in.get(count))
+        return false;
+
+    std::vector<Entry> entries;
+    for (uint64_t i = 0; i < count; ++i) {
+        Entry entry;
+        uint32_t edits = 0;
+        if (!in.get(entry.in_sha256, Sha256::DIGEST_SIZE) || !in.get(entry.out_sha256, Sha256::DIGEST_SIZE)
+            || !in.get(entry.size) || !in.get(edits))
+            return false;
+
+        for (uint32_t n = 0; n < edits; ++n) {
+            Edit edit;
+            uint32_t len = 0;
+            if (!in.get(edit.offset) || !in.get(len)
+                || !in.get(edit.old_bytes, len) || !in.get(edit.new_bytes, len)
+                || edit.offset > entry.size || len > entry.size - edit.offset)
+                return false;
+            entry.edits.push_back(std::move(edit));
+        }
+
+        entries.push_back(std::move(entry));
+    }
+
+    std::for_each(entries.begin(), entries.end(), [this](auto& entry) { add(std::move(entry)); });
+
+    return true;
+}
+
+void Plan::add(Entry entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Same input recorded again: keep the first one
+    if (by_input_.count(entry.in_sha256))
+        return;
+
+    by_input_[entry.in_sha256] = entries_.size();
+    by_output_[entry.out_sha256] = entries_.size();
+    sizes_.insert(entry.size);
+    entries_.push_back(std::move(entry));
+}
+
+bool Plan::save(const std::string& path) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Write aside and rename, concurrent runs each write their own file
+    std::string tmp;
+    if (FD::temp_beside(path, tmp).bad())
+        return false;
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(MAGIC, sizeof(MAGIC));
+        put<uint32_t>(out, VERSION);
+        put<uint64_t>(out, entries_.size());
+
+        std::for_each(entries_.begin(), entries_.end(), [&out](auto& entry) {
+            out.write(entry.in_sha256.data(), entry.in_sha256.size());
+            out.write(entry.out_sha256.data(), entry.out_sha256.size());
+            put<uint64_t>(out, entry.size);
+            put<uint32_t>(out, entry.edits.size());
+            std::for_each(entry.edits.begin(), entry.edits.end(), [&out](auto& edit) {
+                put<uint64_t>(out, edit.offset);
+                put<uint32_t>(out, edit.new_bytes.size());
+                out.write(edit.old_bytes.data(), edit.old_bytes.size());
+                out.write(edit.new_bytes.data(), edit.new_bytes.size());
+            });
+        });
+
+        if (!out.flush()) {
+            ::unlink(tmp.c_str());
+            return false;
+        }
+    }
+
+    if (::rename(tmp.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+Plan::Replayed Plan::replay(const std::string& path, std::ostream& err) const {
+    FD fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.bad()) {
+        err << "error: Can't open " << path << "!" << std::endl;
+        return Failed;
+    }
+
+    // Sizes first, no content read for files no plan can match
+    size_t size = fd.size();
+    if (!sizes_.count(size) || size == 0)
+        return NoPlan;
+
+    auto content = reinterpret_cast<const char*>(fd.mmap(0, 0, PROT_READ, MAP_FILE | MAP_PRIVATE));
+    if (!content) {
+        err << "error: Can't map " << path << "!" << std::endl;
+        return Failed;
+    }
+    fd.prefetch(const_cast<char*>(content));
+
+    auto digest = sha256(content, size);
+
+    if (by_output_.count(digest))
+        return AlreadyApplied;
+
+    auto it = by_input_.find(digest);
+    if (it == by_input_.end())
+        return NoPlan;
+
+    auto& entry = entries_[it->second];
+    bool same_old = std::all_of(entry.edits.begin(), entry.edits.end(), [content](auto& edit) {
+        return ::memcmp(content + edit.offset, edit.old_bytes.data(), edit.old_bytes.size()) == 0;
+    });
+    if (!same_old) {
+        err << "error: " << path << " does not match the recorded plan!" << std::endl;
+        return Failed;
+    }
+
+    FD wfd(::open(path.c_str(), O_WRONLY | O_CLOEXEC));
+    if (wfd.bad()) {
+        err << "error: Can't open " << path << "!" << std::endl;
+        return Failed;
+    }
+
+    bool ok = std::all_of(entry.edits.begin(), entry.edits.end(), [&wfd](auto& edit) {
+        return ::pwrite(wfd.get(), edit.new_bytes.data(), edit.new_bytes.size(), edit.offset) == ssize_t(edit.new_bytes.size());
+    });
+    if (!ok) {
+        err << "error: Can't write " << path << "!" << std::endl;
+        return Failed;
+    }
+
+    return Applied;
+}
@@ -0,0 +1,240 @@
+// Python extension module over the C interface of libsafe_patchelf.
+//
+// Targets are file paths (str or os.PathLike) or objects supporting the
+// buffer protocol (bytes, bytearray, memoryview, mmap), which are used in
+// place without copying. Edits of buffers need writable ones. The GIL is
+// released while files are mapped, parsed, patched and written, so thread
+// pools patch in parallel.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <safe_patchelf/safe_patchelf.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+PyObject* Error = nullptr;
+
+// Handle over a path or a buffer, released with the target
+class Target {
+public:
+    Target() = default;
+
+    ~Target() {
+        if (handle_)
+            safe_patchelf_close(handle_);
+        if (view_.obj)
+            PyBuffer_Release(&view_);
+    }
+
+    // With the GIL held, sets a Python error on failure
+    bool open(PyObject* obj, bool writable) {
+        if (PyUnicode_Check(obj) || PyObject_HasAttrString(obj, "__fspath__")) {
+            PyObject* encoded = nullptr;
+            if (!PyUnicode_FSConverter(obj, &encoded))
+                return false;
+            std::string path(PyBytes_AS_STRING(encoded), PyBytes_GET_SIZE(encoded));
+            Py_DECREF(encoded);
+
+            Py_BEGIN_ALLOW_THREADS
+            handle_ = safe_patchelf_open(path.c_str());
+            Py_END_ALLOW_THREADS
+            file_ = true;
+        } else {
+            if (PyObject_GetBuffer(obj, &view_, writable ? PyBUF_WRITABLE : PyBUF_SIMPLE) != 0)
+                return false;
+
+            Py_BEGIN_ALLOW_THREADS
+            handle_ = safe_patchelf_open_memory(view_.buf, size_t(view_.len));
+            Py_END_ALLOW_THREADS
+        }
+
+        if (!handle_) {
+            PyErr_SetString(Error, safe_patchelf_last_error());
+            return false;
+        }
+        return true;
+    }
+
+    safe_patchelf_t* handle() const { return handle_; }
+    bool file() const { return file_; }
+
+private:
+    Target(const Target&) = delete;
+
+    safe_patchelf_t* handle_ = nullptr;
+    Py_buffer view_ = {};
+    bool file_ = false;
+};
+
+PyObject* optional_str(const char* s) {
+    if (!s)
+        Py_RETURN_NONE;
+    return PyUnicode_DecodeFSDefault(s);
+}
+
+// Applies op without the GIL, commits files, returns the modified ranges
+template<class Op>
+PyObject* edit(PyObject* obj, Op op) {
+    Target target;
+    if (!target.open(obj, true))
+        return nullptr;
+
+    auto h = target.handle();
+    int ret;
+    Py_BEGIN_ALLOW_THREADS
+    ret = op(h);
+    if (ret == 0 && target.file())
+        ret = safe_patchelf_commit(h);
+    Py_END_ALLOW_THREADS
+
+    if (ret != 0) {
+        std::string diagnostics(safe_patchelf_diagnostics(h));
+        while (!diagnostics.empty() && diagnostics.back() == '\n')
+            diagnostics.pop_back();
+        PyErr_SetString(Error, diagnostics.c_str());
+        return nullptr;
+    }
+
+    size_t count = 0;
+    auto ranges = safe_patchelf_modified(h, &count);
+
+    PyObject* list = PyList_New(Py_ssize_t(count));
+    if (!list)
+        return nullptr;
+    for (size_t i = 0; i < count; ++i) {
+        PyObject* range = Py_BuildValue("(nn)", Py_ssize_t(ranges[i].offset), Py_ssize_t(ranges[i].length));
+        if (!range) {
+            Py_DECREF(list);
+            return nullptr;
+        }
+        PyList_SET_ITEM(list, Py_ssize_t(i), range);
+    }
+    return list;
+}
+
+PyObject* query(PyObject*, PyObject* args) {
+    PyObject* obj;
+    if (!PyArg_ParseTuple(args, "O:query", &obj))
+        return nullptr;
+
+    Target target;
+    if (!target.open(obj, false))
+        return nullptr;
+
+    // Parsing happens on the first accessor
+    auto h = target.handle();
+    size_t count;
+    Py_BEGIN_ALLOW_THREADS
+    count = safe_patchelf_needed_count(h);
+    Py_END_ALLOW_THREADS
+
+    PyObject* needed = PyList_New(Py_ssize_t(count));
+    if (!needed)
+        return nullptr;
+    for (size_t i = 0; i < count; ++i) {
+        PyObject* name = PyUnicode_DecodeFSDefault(safe_patchelf_needed(h, i));
+        if (!name) {
+            Py_DECREF(needed);
+            return nullptr;
+        }
+        PyList_SET_ITEM(needed, Py_ssize_t(i), name);
+    }
+
+    return Py_BuildValue("{s:i,s:I,s:N,s:N,s:N,s:N,s:N}",
+                         "class", safe_patchelf_elf_class(h),
+                         "machine", safe_patchelf_machine(h),
+                         "soname", optional_str(safe_patchelf_soname(h)),
+                         "needed", needed,
+                         "rpath", optional_str(safe_patchelf_rpath(h)),
+                         "runpath", optional_str(safe_patchelf_runpath(h)),
+                         "interpreter", optional_str(safe_patchelf_interpreter(h)));
+}
+
+PyObject* set_soname(PyObject*, PyObject* args) {
+    PyObject* obj;
+    const char* soname;
+    if (!PyArg_ParseTuple(args, "Os:set_soname", &obj, &soname))
+        return nullptr;
+
+    std::string value(soname);
+    return edit(obj, [&value](safe_patchelf_t* h) { return safe_patchelf_set_soname(h, value.c_str()); });
+}
+
+PyObject* update_neededs(PyObject*, PyObject* args) {
+    PyObject* obj;
+    PyObject* dict;
+    if (!PyArg_ParseTuple(args, "OO!:update_neededs", &obj, &PyDict_Type, &dict))
+        return nullptr;
+
+    std::map<std::string, std::string> replacements;
+    PyObject* key;
+    PyObject* value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(dict, &pos, &key, &value)) {
+        const char* old_needed = PyUnicode_AsUTF8(key);
+        const char* new_needed = old_needed ? PyUnicode_AsUTF8(value) : nullptr;
+        if (!new_needed)
+            return nullptr;
+        replacements[old_needed] = new_needed;
+    }
+
+    // One pass over all of them, like the command line
+    std::vector<const char*> olds, news;
+    for (auto& it : replacements) {
+        olds.push_back(it.first.c_str());
+        news.push_back(it.second.c_str());
+    }
+
+    return edit(obj, [&](safe_patchelf_t* h) {
+        return safe_patchelf_replace_neededs(h, olds.data(), news.data(), olds.size());
+    });
+}
+
+PyMethodDef methods[] = {
+    {"query", query, METH_VARARGS,
+     "query(target) -> dict\n\n"
+     "Dynamic summary: class, machine, soname, needed, rpath, runpath and interpreter."},
+    {"set_soname", set_soname, METH_VARARGS,
+     "set_soname(target, soname) -> [(offset, length)]\n\n"
+     "Sets DT_SONAME, files are written, writable buffers patched in place.\n"
+     "Returns the modified byte ranges, raises safe_patchelf.Error on failure."},
+    {"update_neededs", update_neededs, METH_VARARGS,
+     "update_neededs(target, {old: new}) -> [(offset, length)]\n\n"
+     "Renames DT_NEEDED entries, files are written, writable buffers patched in place.\n"
+     "Succeeds when at least one old name is needed, failed edits leave buffers unchanged.\n"
+     "Returns the modified byte ranges, raises safe_patchelf.Error on failure."},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+PyModuleDef module = {
+    PyModuleDef_HEAD_INIT,
+    "safe_patchelf",
+    "In process ELF patching with safe_patchelf. Targets are paths or buffers.",
+    -1,
+    methods,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+};
+
+} // namespace
+
+PyMODINIT_FUNC PyInit_safe_patchelf(void) {
+    PyObject* m = PyModule_Create(&module);
+    if (!m)
+        return nullptr;
+
+    Error = PyErr_NewException("safe_patchelf.Error", nullptr, nullptr);
+    if (!Error || PyModule_AddObjectRef(m, "Error", Error) != 0) {
+        Py_DECREF(m);
+        return nullptr;
+    }
+
+    return m;
+}
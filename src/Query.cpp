@@ -0,0 +1,145 @@
+#include <safe_patchelf/Query.h>
+#include <safe_patchelf/Dispatch.h>
+#include <safe_patchelf/Scheduler.h>
+#include <safe_patchelf/Walker.h>
+#include <safe_patchelf/Json.h>
+#include <safe_patchelf/FD.h>
+
+#include <fcntl.h>
+
+#include <mutex>
+#include <sstream>
+#include <iostream>
+
+struct DoElfQuery {
+    template<class E>
+    static bool entry(E& elf, size_t size, ElfSummary& summary) {
+        summary = elf.summary(size);
+        return true;
+    }
+};
+
+/*static*/ std::optional<ElfSummary> Query::query_file(const std::string& path, std::string& error, bool* not_elf) {
+    FD fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.bad()) {
+        error = "Can't open file";
+        return std::nullopt;
+    }
+
+    // Sniff the identification bytes before mapping, most files are not ELF
+    char ident[EI_NIDENT];
+    if (::pread(fd.get(), ident, sizeof(ident), 0) != sizeof(ident)
+        || elf_class(ident).first == None) {
+        error = "not an ELF file";
+        if (not_elf)
+            *not_elf = true;
+        return std::nullopt;
+    }
+
+    size_t size = fd.size();
+    auto content = reinterpret_cast<caddr_t>(fd.mmap(0, 0, PROT_READ, MAP_FILE | MAP_PRIVATE));
+    if (!content) {
+        error = "Can't map file";
+        return std::nullopt;
+    }
+
+    auto el_class = elf_class(content);
+    if (!elf_headers_fit(content, size, el_class)) {
+        error = "Broken ELF headers";
+        return std::nullopt;
+    }
+
+    return summarize(content, size);
+}
+
+/*static*/ ElfSummary Query::summarize(caddr_t content, size_t size) {
+    auto el_class = elf_class(content);
+
+    ElfSummary summary;
+    if (el_class.first == Elf32)
+        class_entry<Elf32, DoElfQuery>(content, el_class.second, size, summary);
+    else
+        class_entry<Elf64, DoElfQuery>(content, el_class.second, size, summary);
+
+    return summary;
+}
+
+/*static*/ std::optional<ElfSummary> Query::query_entry(const Walker::Entry& entry, ScanCache* cache, std::string& error) {
+    if (!cache)
+        return query_file(entry.path, error);
+
+    std::optional<ElfSummary> summary;
+    auto record = cache->find(entry.st, &summary);
+    if (record && record->kind == ScanCache::NotElf) {
+        error = "not an ELF file";
+        return std::nullopt;
+    }
+    if (record && summary)
+        return summary;
+
+    bool not_elf = false;
+    summary = query_file(entry.path, error, &not_elf);
+    if (summary)
+        cache->record_elf(entry.st, *summary);
+    else if (not_elf)
+        cache->record_not_elf(entry.st);
+
+    return summary;
+}
+
+/*static*/ int Query::run(const Args& args) {
+    bool failed = false;
+    auto entries = Walker::collect(args.filenames, std::cerr, false, &failed);
+
+    std::optional<ScanCache> cache;
+    if (!args.cache.empty()) {
+        cache.emplace();
+        cache->load(args.cache);
+    }
+
+    auto groups = Walker::group_by_inode(entries);
+
+    std::mutex out_mutex;
+    bool success = !failed;
+
+    // Hardlinked paths are parsed once and reported for every path
+    Scheduler::run(groups.size(), args.jobs, [&](size_t i) {
+        auto& links = groups[i];
+
+        std::string error;
+        auto summary = query_entry(*links.front(), cache ? &*cache : nullptr, error);
+
+        std::ostringstream record;
+        std::for_each(links.begin(), links.end(), [&](auto* entry) {
+            // Files found in directories are silently skipped when not ELF
+            if (!summary && entry->from_dir)
+                return;
+
+            if (summary) {
+                summary->print_json(record, entry->path);
+            } else {
+                record << "{\"file\":";
+                Json::quoted(record, entry->path);
+                record << ",\"error\":";
+                Json::quoted(record, error);
+                record << "}";
+            }
+            record << "\n";
+        });
+
+        if (record.tellp() == 0)
+            return;
+
+        std::lock_guard<std::mutex> lock(out_mutex);
+        std::cout << record.str() << std::flush;
+        if (!summary)
+            success = false;
+    });
+
+    if (cache && !cache->save(args.cache)) {
+        std::cerr << "error: Can't write cache " << args.cache << "!" << std::endl;
+        success = false;
+    }
+
+    return success ? 0 : -1;
+}
@@ -0,0 +1,282 @@
+#include <safe_patchelf/ScanCache.h>
+#include <safe_patchelf/commons.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+namespace {
+
+const char     MAGIC[8] = {'S', 'P', 'E', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t VERSION  = 1;
+
+enum SummaryFlags : uint8_t {
+    HasSoname   = 1,
+    HasRpath    = 2,
+    HasRunpath  = 4,
+    HasInterp   = 8,
+};
+
+uint64_t mix(uint64_t dev, uint64_t ino) {
+    uint64_t h = ino * 0x9e3779b97f4a7c15ULL ^ (dev + 0x632be59bd9b4e019ULL);
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+bool same(const ScanCache::Key& a, const ScanCache::Key& b) {
+    return a.dev == b.dev && a.ino == b.ino && a.size == b.size && a.mtime_ns == b.mtime_ns;
+}
+
+} // namespace
+
+/*static*/ ScanCache::Key ScanCache::Key::of(const struct ::stat& st) {
+    return Key{
+        uint64_t(st.st_dev),
+        uint64_t(st.st_ino),
+        uint64_t(st.st_size),
+        uint64_t(st.st_mtim.tv_sec) * 1000000000ULL + uint64_t(st.st_mtim.tv_nsec),
+    };
+}
+
+size_t ScanCache::KeyHash::operator()(const std::pair<uint64_t, uint64_t>& k) const {
+    return mix(k.first, k.second);
+}
+
+bool ScanCache::load(const std::string& path) {
+    FD fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.bad())
+        return false;
+
+    size_t size = fd.size();
+    if (size < sizeof(Header))
+        return false;
+
+    auto content = reinterpret_cast<const char*>(fd.mmap(0, 0, PROT_READ, MAP_FILE | MAP_PRIVATE));
+    if (!content)
+        return false;
+
+    auto header = reinterpret_cast<const Header*>(content);
+    if (::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0
+        || header->version != VERSION
+        || header->record_size != sizeof(Record)
+        || header->buckets == 0
+        || (header->buckets & (header->buckets - 1)) != 0
+        || header->buckets > (size - sizeof(Header)) / sizeof(Record)
+        || header->blob_offset < sizeof(Header) + header->buckets * sizeof(Record)
+        || header->blob_offset > size
+        || header->blob_size > size - header->blob_offset)
+        return false;
+
+    fd_      = std::move(fd);
+    header_  = header;
+    records_ = reinterpret_cast<const Record*>(content + sizeof(Header));
+    blob_    = content + header->blob_offset;
+
+    return true;
+}
+
+std::optional<ScanCache::Lookup> ScanCache::find_mapped(const Key& key) const {
+    if (!header_)
+        return std::nullopt;
+
+    uint64_t mask = header_->buckets - 1;
+    for (uint64_t i = mix(key.dev, key.ino) & mask, n = 0; n <= mask; i = (i + 1) & mask, ++n) {
+        auto& rec = records_[i];
+        if (rec.kind == Empty)
+            return std::nullopt;
+        if (rec.key.dev != key.dev || rec.key.ino != key.ino)
+            continue;
+        if (!same(rec.key, key))
+            return std::nullopt;
+        if (rec.summary_off > header_->blob_size || rec.summary_len > header_->blob_size - rec.summary_off)
+            return std::nullopt;
+        return Lookup{&rec, blob_ + rec.summary_off};
+    }
+
+    return std::nullopt;
+}
+
+std::optional<ScanCache::Record> ScanCache::find(const struct ::stat& st, std::optional<ElfSummary>* summary) const {
+    auto key = Key::of(st);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = updates_.find(std::make_pair(key.dev, key.ino));
+        if (it != updates_.end()) {
+            if (!same(it->second.first.key, key))
+                return std::nullopt;
+            if (summary && it->second.first.elf_class)
+                *summary = decode(it->second.first, it->second.second.data());
+            return it->second.first;
+        }
+    }
+
+    auto found = find_mapped(key);
+    if (!found)
+        return std::nullopt;
+
+    if (summary && found->record->elf_class)
+        *summary = decode(*found->record, found->summary);
+
+    return *found->record;
+}
+
+void ScanCache::record_not_elf(const struct ::stat& st) {
+    Record rec{};
+    rec.key  = Key::of(st);
+    rec.kind = NotElf;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    updates_[std::make_pair(rec.key.dev, rec.key.ino)] = std::make_pair(rec, std::string());
+}
+
+void ScanCache::record_elf(const struct ::stat& st, const ElfSummary& summary, uint64_t rules) {
+    Record rec{};
+    rec.key       = Key::of(st);
+    rec.kind      = IsElf;
+    rec.elf_class = (summary.elf_class == ElfClassTraits<Elf64>::name) ? 64 : 32;
+    rec.endian    = (summary.endian == "little") ? Little : Big;
+    rec.machine   = summary.machine;
+    rec.type      = summary.type;
+    rec.rules     = rules;
+
+    auto data = encode(summary);
+    rec.summary_len = data.size();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    updates_[std::make_pair(rec.key.dev, rec.key.ino)] = std::make_pair(rec, std::move(data));
+}
+
+bool ScanCache::save(const std::string& path) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Nothing new, the loaded file is still up to date
+    if (updates_.empty() && header_)
+        return true;
+
+    std::vector<std::pair<Record, std::string> > all;
+    all.reserve(updates_.size() + (header_ ? header_->buckets : 0));
+
+    if (header_) {
+        for (uint64_t i = 0; i < header_->buckets; ++i) {
+            auto& rec = records_[i];
+            if (rec.kind == Empty || updates_.count(std::make_pair(rec.key.dev, rec.key.ino)))
+                continue;
+            if (rec.summary_off > header_->blob_size || rec.summary_len > header_->blob_size - rec.summary_off)
+                continue;
+            all.push_back(std::make_pair(rec, std::string(blob_ + rec.summary_off, rec.summary_len)));
+        }
+    }
+    std::for_each(updates_.begin(), updates_.end(), [&](auto& it) { all.push_back(it.second); });
+
+    uint64_t buckets = 16;
+    while (buckets < all.size() * 2)
+        buckets <<= 1;
+
+    std::vector<Record> table(buckets);
+    std::string blob;
+
+    std::for_each(all.begin(), all.end(), [&](auto& it) {
+        Record rec = it.first;
+        rec.summary_off = blob.size();
+        rec.summary_len = it.second.size();
+        blob += it.second;
+
+        uint64_t i = mix(rec.key.dev, rec.key.ino) & (buckets - 1);
+        while (table[i].kind != Empty)
+            i = (i + 1) & (buckets - 1);
+        table[i] = rec;
+    });
+
+    Header header{};
+    ::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version     = VERSION;
+    header.record_size = sizeof(Record);
+    header.buckets     = buckets;
+    header.blob_offset = sizeof(Header) + buckets * sizeof(Record);
+    header.blob_size   = blob.size();
+
+    // Write aside and rename, readers never see a partial file. The name
+    // is unique, concurrent runs don't write into each other's file.
+    std::string tmp;
+    if (FD::temp_beside(path, tmp).bad())
+        return false;
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(Record));
+        out.write(blob.data(), blob.size());
+        if (!out) {
+            ::unlink(tmp.c_str());
+            return false;
+        }
+    }
+
+    if (::rename(tmp.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*static*/ std::string ScanCache::encode(const ElfSummary& summary) {
+    std::string out;
+
+    uint8_t flags = 0;
+    if (summary.soname)  flags |= HasSoname;
+    if (summary.rpath)   flags |= HasRpath;
+    if (summary.runpath) flags |= HasRunpath;
+    if (summary.interp)  flags |= HasInterp;
+
+    out.push_back(char(flags));
+
+    auto put = [&out](const std::string& s) {
+        out += s;
+        out.push_back('\0');
+    };
+
+    if (summary.soname)  put(*summary.soname);
+    if (summary.rpath)   put(*summary.rpath);
+    if (summary.runpath) put(*summary.runpath);
+    if (summary.interp)  put(*summary.interp);
+    std::for_each(summary.needed.begin(), summary.needed.end(), put);
+
+    return out;
+}
+
+/*static*/ ElfSummary ScanCache::decode(const Record& record, const char* data) {
+    ElfSummary summary;
+
+    summary.elf_class = (record.elf_class == 64) ? ElfClassTraits<Elf64>::name : ElfClassTraits<Elf32>::name;
+    summary.endian    = (record.endian == Little) ? "little" : "big";
+    summary.machine   = record.machine;
+    summary.type      = record.type;
+
+    if (record.summary_len == 0)
+        return summary;
+
+    const char* p   = data + 1;
+    const char* end = data + record.summary_len;
+    uint8_t flags = uint8_t(data[0]);
+
+    auto get = [&p, end]() {
+        auto len = ::strnlen(p, end - p);
+        std::string s(p, len);
+        p += std::min<size_t>(len + 1, end - p);
+        return s;
+    };
+
+    if (flags & HasSoname)  summary.soname  = get();
+    if (flags & HasRpath)   summary.rpath   = get();
+    if (flags & HasRunpath) summary.runpath = get();
+    if (flags & HasInterp)  summary.interp  = get();
+    while (p < end)
+        summary.needed.push_back(get());
+
+    return summary;
+}
@@ -0,0 +1,38 @@
+#include <safe_patchelf/Scheduler.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+/*static*/ unsigned Scheduler::default_jobs() {
+    unsigned jobs = std::thread::hardware_concurrency();
+    return jobs ? jobs : 1;
+}
+
+/*static*/ void Scheduler::run(size_t count, unsigned jobs, const std::function<void(size_t)>& task) {
+    if (jobs == 0)
+        jobs = default_jobs();
+
+    jobs = std::min<size_t>(jobs, count);
+    if (jobs <= 1) {
+        for (size_t i = 0; i < count; ++i)
+            task(i);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++)
+            task(i);
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(jobs - 1);
+    for (unsigned i = 1; i < jobs; ++i)
+        threads.emplace_back(worker);
+
+    worker();
+
+    std::for_each(threads.begin(), threads.end(), [](auto& t) { t.join(); });
+}
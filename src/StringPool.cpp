@@ -0,0 +1,21 @@
+#include <safe_patchelf/StringPool.h>
+
+StringPool::Id StringPool::intern(const std::string& s) {
+    auto ret = ids_.insert(std::make_pair(s, Id(strings_.size())));
+    if (ret.second)
+        strings_.push_back(&ret.first->first);
+    return ret.first->second;
+}
+
+StringPool::Id StringPool::find(const std::string& s) const {
+    auto it = ids_.find(s);
+    return (it != ids_.end()) ? it->second : NONE;
+}
+
+const std::string& StringPool::str(Id id) const {
+    return *strings_[id];
+}
+
+size_t StringPool::size() const {
+    return strings_.size();
+}
@@ -0,0 +1,61 @@
+#include <safe_patchelf/Summary.h>
+#include <safe_patchelf/Json.h>
+
+#include <elf/elf.h>
+
+#include <algorithm>
+
+/*static*/ const char* ElfSummary::machine_name(unsigned machine) {
+    switch (machine) {
+    case EM_386:        return "i386";
+    case EM_X86_64:     return "x86_64";
+    case EM_ARM:        return "arm";
+    case EM_AARCH64:    return "aarch64";
+    case EM_MIPS:       return "mips";
+    case EM_PPC:        return "ppc";
+    case EM_PPC64:      return "ppc64";
+    case EM_S390:       return "s390";
+    case EM_SPARCV9:    return "sparcv9";
+    case 243:           return "riscv"; // EM_RISCV, missing in elf/elf.h
+    default:            return nullptr;
+    }
+}
+
+void ElfSummary::print_json(std::ostream& out, const std::string& filename) const {
+    auto optional_field = [&out](const char* name, const std::optional<std::string>& value) {
+        out << ",\"" << name << "\":";
+        if (value)
+            Json::quoted(out, *value);
+        else
+            out << "null";
+    };
+
+    out << "{\"file\":";
+    Json::quoted(out, filename);
+    out << ",\"class\":\"" << elf_class << "\""
+        << ",\"endian\":\"" << endian << "\""
+        << ",\"machine\":";
+    if (auto name = machine_name(machine))
+        out << "\"" << name << "\"";
+    else
+        out << machine;
+    out << ",\"type\":" << type;
+
+    optional_field("soname", soname);
+
+    out << ",\"needed\":[";
+    bool first = true;
+    std::for_each(needed.begin(), needed.end(), [&](auto& n) {
+        if (!first)
+            out << ",";
+        Json::quoted(out, n);
+        first = false;
+    });
+    out << "]";
+
+    optional_field("rpath",   rpath);
+    optional_field("runpath", runpath);
+    optional_field("interp",  interp);
+
+    out << "}";
+}
@@ -0,0 +1,628 @@
+#include <safe_patchelf/Tar.h>
+#include <safe_patchelf/Batch.h>
+#include <safe_patchelf/Dispatch.h>
+#include <safe_patchelf/Compression.h>
+#include <safe_patchelf/Scheduler.h>
+#include <safe_patchelf/Queue.h>
+#include <safe_patchelf/Hash.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <future>
+#include <new>
+#include <sstream>
+#include <optional>
+#include <algorithm>
+
+namespace {
+
+const size_t COPY_SIZE = 1 << 20;
+const size_t MAX_METADATA = 1 << 20;
+
+struct Header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+static_assert(sizeof(Header) == Tar::BLOCK, "tar header is one block");
+
+// Octal, or base-256 (GNU) when the high bit of the first byte is set
+std::optional<uint64_t> number(const char* field, size_t len) {
+    if (len && (uint8_t(field[0]) & 0x80)) {
+        uint64_t value = uint8_t(field[0]) & 0x7f;
+        for (size_t i = 1; i < len; ++i) {
+            if (value >> 56)
+                return std::nullopt;
+            value = (value << 8) | uint8_t(field[i]);
+        }
+        return value;
+    }
+
+    uint64_t value = 0;
+    size_t i = 0;
+    while (i < len && field[i] == ' ')
+        ++i;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; ++i)
+        value = (value << 3) | uint64_t(field[i] - '0');
+    return value;
+}
+
+bool checksum_ok(const Header& h) {
+    auto bytes = reinterpret_cast<const uint8_t*>(&h);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < sizeof(Header); ++i)
+        sum += (i >= offsetof(Header, chksum) && i < offsetof(Header, chksum) + sizeof(h.chksum)) ? ' ' : bytes[i];
+
+    auto stored = number(h.chksum, sizeof(h.chksum));
+    return stored && *stored == sum;
+}
+
+std::string field(const char* f, size_t len) {
+    return std::string(f, ::strnlen(f, len));
+}
+
+// Values of the pax extended header records we care about
+void parse_pax(const std::string& data, uint64_t& size, bool& has_size, std::string& path) {
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t space = data.find(' ', pos);
+        if (space == std::string::npos)
+            return;
+        size_t len = ::strtoull(data.c_str() + pos, nullptr, 10);
+        if (len == 0 || pos + len > data.size())
+            return;
+
+        std::string record = data.substr(space + 1, pos + len - space - 2);
+        auto eq = record.find('=');
+        if (eq != std::string::npos) {
+            auto key = record.substr(0, eq);
+            if (key == "size") {
+                size = ::strtoull(record.c_str() + eq + 1, nullptr, 10);
+                has_size = true;
+            }
+            else if (key == "path")
+                path = record.substr(eq + 1);
+        }
+        pos += len;
+    }
+}
+
+// Archive input: bytes already read (format sniffing) first
+class Input {
+public:
+    Input(int fd, const std::string& prefix)
+        : fd_(fd)
+        , pending_(prefix)
+    {
+    }
+
+    bool read(void* buf, size_t len) {
+        size_t n = std::min(len, pending_.size() - pos_);
+        ::memcpy(buf, pending_.data() + pos_, n);
+        pos_ += n;
+        return Tar::read_full(fd_, reinterpret_cast<char*>(buf) + n, len - n);
+    }
+
+    bool pass(int out, size_t len) {
+        size_t n = std::min(len, pending_.size() - pos_);
+        if (!Tar::write_full(out, pending_.data() + pos_, n))
+            return false;
+        pos_ += n;
+        return Tar::pass(fd_, out, len - n);
+    }
+
+    // Up to len bytes, 0 at the end
+    ssize_t some(void* buf, size_t len) {
+        if (pos_ < pending_.size()) {
+            size_t n = std::min(len, pending_.size() - pos_);
+            ::memcpy(buf, pending_.data() + pos_, n);
+            pos_ += n;
+            return n;
+        }
+        ssize_t n;
+        do {
+            n = ::read(fd_, buf, len);
+        } while (n < 0 && errno == EINTR);
+        return n;
+    }
+
+private:
+    int fd_;
+    std::string pending_;
+    size_t pos_ = 0;
+};
+
+// Output of members in archive order. With more than one job ELF members
+// are patched asynchronously and pass through data is buffered in pieces,
+// a writer thread waits for them in order. Otherwise everything happens
+// inline and pass through data is spliced.
+class Writer {
+public:
+    Writer(int out, unsigned jobs, const Args& args, std::ostream& err, Tar::Stats& stats)
+        : out_(out)
+        , args_(args)
+        , err_(err)
+        , stats_(stats)
+        , queue_(2 * jobs)
+    {
+        if (jobs > 1)
+            thread_ = std::thread([this] { drain(); });
+    }
+
+    ~Writer() {
+        finish();
+    }
+
+    bool data(std::vector<char> bytes) {
+        if (!thread_.joinable())
+            return write(ready(std::move(bytes)));
+
+        std::promise<Piece> promise;
+        promise.set_value(ready(std::move(bytes)));
+        return queue_.push(promise.get_future());
+    }
+
+    bool pass(Input& in, size_t len) {
+        if (!thread_.joinable())
+            return in.pass(out_, len);
+
+        while (len) {
+            std::vector<char> bytes(std::min(len, COPY_SIZE));
+            if (!in.read(bytes.data(), bytes.size()) || !data(std::move(bytes)))
+                return false;
+            len -= std::min(len, COPY_SIZE);
+        }
+        return true;
+    }
+
+    // bytes: padded member data, size: member size
+    bool elf(std::vector<char> bytes, size_t size, std::string name) {
+        if (!thread_.joinable())
+            return write(patch(std::move(bytes), size, name, args_));
+
+        return queue_.push(std::async(std::launch::async, patch, std::move(bytes), size, std::move(name), std::cref(args_)));
+    }
+
+    // ELF member that couldn't be patched, its data follows unchanged
+    bool failed(std::string messages) {
+        Piece piece;
+        piece.elf = true;
+        piece.ret = -1;
+        piece.messages = std::move(messages);
+        if (!thread_.joinable())
+            return write(piece);
+
+        std::promise<Piece> promise;
+        promise.set_value(std::move(piece));
+        return queue_.push(promise.get_future());
+    }
+
+    // Result of the patched members, -1 when output failed
+    int finish() {
+        if (thread_.joinable()) {
+            queue_.close();
+            thread_.join();
+        }
+        return failed_ ? -1 : ret_;
+    }
+
+    // All output so far went out
+    bool written() const { return !failed_; }
+
+private:
+    struct Piece {
+        std::vector<char> bytes;
+        bool elf = false;
+        int ret = 0;
+        bool changed = false;
+        std::string messages;
+    };
+
+    static Piece ready(std::vector<char> bytes) {
+        Piece piece;
+        piece.bytes = std::move(bytes);
+        return piece;
+    }
+
+    // Failed member goes out as it came in
+    static Piece patch(std::vector<char> bytes, size_t size, const std::string& name, const Args& args) {
+        Piece piece;
+        piece.elf = true;
+
+        std::vector<char> original;
+        std::ostringstream messages;
+        try {
+            original.assign(bytes.begin(), bytes.begin() + size);
+            piece.ret = Batch::patch_buffer(bytes.data(), size, args, name + ": ", messages, messages, &piece.changed);
+        } catch (const std::bad_alloc&) {
+            messages << name << ": error: Not enough memory to patch!" << std::endl;
+            piece.ret = -1;
+        }
+        if (piece.ret != 0 && original.size() == size)
+            std::copy(original.begin(), original.end(), bytes.begin());
+
+        piece.bytes = std::move(bytes);
+        piece.messages = messages.str();
+        return piece;
+    }
+
+    bool write(const Piece& piece) {
+        if (piece.elf) {
+            err_ << piece.messages << std::flush;
+            if (piece.ret != 0) {
+                ++stats_.failed;
+                ret_ = -1;
+            } else if (piece.changed) {
+                ++stats_.changed;
+            }
+        }
+
+        if (!failed_ && !Tar::write_full(out_, piece.bytes.data(), piece.bytes.size()))
+            failed_ = true;
+        return !failed_;
+    }
+
+    void drain() {
+        while (auto piece = queue_.pop()) {
+            if (!write(piece->get()))
+                queue_.close();
+        }
+    }
+
+    int out_;
+    const Args& args_;
+    std::ostream& err_;
+    Tar::Stats& stats_;
+
+    BoundedQueue<std::future<Piece> > queue_;
+    std::thread thread_;
+    int ret_ = 0;
+    bool failed_ = false;
+};
+
+// Pipeline stage hashing everything written to fd() on its way to out
+class HashStage {
+public:
+    explicit HashStage(int out) {
+        if (::pipe2(fds_, O_CLOEXEC) != 0)
+            return;
+        ::fcntl(fds_[1], F_SETPIPE_SZ, int(COPY_SIZE));
+
+        thread_ = std::thread([this, out] {
+            std::vector<char> buf(COPY_SIZE);
+            while (true) {
+                ssize_t n = ::read(fds_[0], buf.data(), buf.size());
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0)
+                    ok_ = false;
+                if (n <= 0)
+                    break;
+                sha_.update(buf.data(), n);
+                size_ += n;
+                if (!Tar::write_full(out, buf.data(), n)) {
+                    ok_ = false;
+                    break;
+                }
+            }
+            ::close(fds_[0]);
+        });
+    }
+
+    bool bad() const { return fds_[1] < 0; }
+
+    int fd() const { return fds_[1]; }
+
+    // Ends the input and waits for the rest to be written
+    bool finish(std::string& digest, uint64_t& size) {
+        if (bad())
+            return false;
+        ::close(fds_[1]);
+        thread_.join();
+        digest = sha_.hex_digest();
+        size = size_;
+        return ok_;
+    }
+
+private:
+    int fds_[2] = {-1, -1};
+    std::thread thread_;
+    Sha256 sha_;
+    uint64_t size_ = 0;
+    bool ok_ = true;
+};
+
+} // namespace
+
+/*static*/ bool Tar::read_full(int fd, void* buf, size_t len) {
+    auto p = reinterpret_cast<char*>(buf);
+    while (len) {
+        ssize_t n = ::read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*static*/ bool Tar::write_full(int fd, const void* buf, size_t len) {
+    auto p = reinterpret_cast<const char*>(buf);
+    while (len) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*static*/ bool Tar::pass(int in, int out, size_t len) {
+    // Zero copy when one side is a pipe, falls back on the first refusal
+    while (len) {
+        ssize_t n = ::splice(in, nullptr, out, nullptr, std::min(len, COPY_SIZE), SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len -= n;
+    }
+
+    std::vector<char> buf(std::min(len, COPY_SIZE));
+    while (len) {
+        size_t chunk = std::min(len, buf.size());
+        if (!read_full(in, buf.data(), chunk) || !write_full(out, buf.data(), chunk))
+            return false;
+        len -= chunk;
+    }
+    return true;
+}
+
+/*static*/ int Tar::filter(int in_fd, int out, const Args& args, std::ostream& err, Stats* stats,
+                          const std::string& prefix, unsigned jobs) {
+    Stats local;
+    Stats& st = stats ? *stats : local;
+
+    // Error returns leave the pending output to the writer destructor
+    Input in(in_fd, prefix);
+    Writer writer(out, jobs, args, err, st);
+
+    // Carried over from pax 'x' and GNU 'L' members to the next one
+    uint64_t next_size = 0;
+    bool has_next_size = false;
+    std::string next_name;
+
+    while (true) {
+        std::vector<char> block(BLOCK);
+        auto& h = *reinterpret_cast<Header*>(block.data());
+
+        if (!in.read(block.data(), BLOCK)) {
+            err << "error: Unexpected end of tar stream!" << std::endl;
+            return -1;
+        }
+
+        // End of archive: the rest (zero blocks, record padding) as is
+        if (std::all_of(block.begin(), block.end(), [](char c) { return c == 0; })) {
+            bool ok = writer.data(std::move(block));
+            while (ok) {
+                std::vector<char> rest(COPY_SIZE);
+                ssize_t n = in.some(rest.data(), rest.size());
+                if (n <= 0)
+                    break;
+                rest.resize(n);
+                ok = writer.data(std::move(rest));
+            }
+            int ret = writer.finish();
+            st.complete = ok && writer.written();
+            return ok ? ret : -1;
+        }
+
+        if (!checksum_ok(h)) {
+            err << "error: Bad tar header checksum!" << std::endl;
+            return -1;
+        }
+
+        auto header_size = number(h.size, sizeof(h.size));
+        if (!header_size) {
+            err << "error: Bad tar member size!" << std::endl;
+            return -1;
+        }
+
+        uint64_t size = has_next_size ? next_size : *header_size;
+        std::string name = !next_name.empty() ? next_name
+            : (h.prefix[0] && !::memcmp(h.magic, "ustar", 5) ? field(h.prefix, sizeof(h.prefix)) + "/" : std::string())
+              + field(h.name, sizeof(h.name));
+        uint64_t padded = (size + BLOCK - 1) / BLOCK * BLOCK;
+        char typeflag = h.typeflag;
+
+        if (!writer.data(std::move(block)))
+            return -1;
+
+        // Metadata members apply to the next one, they are small
+        if (typeflag == 'x' || typeflag == 'L') {
+            if (padded > MAX_METADATA) {
+                err << "error: Bad tar member size!" << std::endl;
+                return -1;
+            }
+
+            std::vector<char> data(padded);
+            if (!in.read(data.data(), padded))
+                return -1;
+
+            std::string value(data.data(), size);
+            if (!writer.data(std::move(data)))
+                return -1;
+
+            if (typeflag == 'x')
+                parse_pax(value, next_size, has_next_size, next_name);
+            else
+                next_name = field(value.data(), value.size());
+            continue;
+        }
+
+        has_next_size = false;
+        next_name.clear();
+        ++st.members;
+
+        bool regular = typeflag == '0' || typeflag == '\0' || typeflag == '7';
+        if (!regular || size < EI_NIDENT) {
+            if (!writer.pass(in, padded))
+                return -1;
+            continue;
+        }
+
+        // First block decides
+        std::vector<char> data(BLOCK);
+        if (!in.read(data.data(), BLOCK))
+            return -1;
+
+        if (elf_class(data.data()).first == None) {
+            if (!writer.data(std::move(data)) || !writer.pass(in, padded - BLOCK))
+                return -1;
+            continue;
+        }
+
+        ++st.elf;
+
+        // Members too large to hold in memory go out unchanged
+        try {
+            data.resize(padded);
+        } catch (const std::bad_alloc&) {
+            if (!writer.failed(name + ": error: Not enough memory to patch!\n") || !writer.data(std::move(data))
+                || !writer.pass(in, padded - BLOCK))
+                return -1;
+            continue;
+        }
+
+        if (!in.read(data.data() + BLOCK, padded - BLOCK) || !writer.elf(std::move(data), size, name))
+            return -1;
+    }
+}
+
+/*static*/ int Tar::stream(int in, int out, const Args& args, std::ostream& err, Stats* stats, Digests* digests) {
+    unsigned jobs = args.jobs ? args.jobs : Scheduler::default_jobs();
+
+    // Sniff the compression, the bytes read go first into the next stage
+    std::string prefix(BLOCK, '\0');
+    size_t got = 0;
+    while (got < prefix.size()) {
+        ssize_t n = ::read(in, &prefix[got], prefix.size() - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    prefix.resize(got);
+
+    // A stage stopping early must not kill the process
+    ::signal(SIGPIPE, SIG_IGN);
+
+    auto format = Compression::detect(prefix.data(), prefix.size());
+    if (format == Compression::None && !digests)
+        return filter(in, out, args, err, stats, prefix, jobs);
+
+    if (format == Compression::None) {
+        HashStage hash(out);
+        if (hash.bad())
+            return -1;
+        int ret = filter(in, hash.fd(), args, err, stats, prefix, jobs);
+        bool ok = hash.finish(digests->uncompressed, digests->size);
+        digests->compressed = digests->uncompressed;
+        if (!ok && stats)
+            stats->complete = false;
+        return ok ? ret : -1;
+    }
+
+    if (!Compression::supported(format)) {
+        err << "error: " << Compression::name(format) << " compressed archives are not supported by this build!" << std::endl;
+        return -1;
+    }
+
+    // decompress -> pipe -> tar filter -> pipe -> compress, each stage on
+    // its own thread, the pipes are the bounded queues between them
+    int unpacked[2], packed[2];
+    if (::pipe2(unpacked, O_CLOEXEC) != 0)
+        return -1;
+    if (::pipe2(packed, O_CLOEXEC) != 0) {
+        ::close(unpacked[0]);
+        ::close(unpacked[1]);
+        return -1;
+    }
+    ::fcntl(unpacked[1], F_SETPIPE_SZ, int(COPY_SIZE));
+    ::fcntl(packed[1], F_SETPIPE_SZ, int(COPY_SIZE));
+
+    // With digests both ends of the compressor get a hashing stage
+    std::optional<HashStage> plain_hash, packed_hash;
+    if (digests) {
+        plain_hash.emplace(packed[1]);
+        packed_hash.emplace(out);
+    }
+    bool hashes_ok = !digests || (!plain_hash->bad() && !packed_hash->bad());
+
+    bool unpacked_ok = false, packed_ok = false;
+    std::thread decompressor([&] {
+        unpacked_ok = Compression::decompress(format, prefix, in, unpacked[1], err);
+        ::close(unpacked[1]);
+    });
+    std::thread compressor([&] {
+        packed_ok = Compression::compress(format, packed[0], (digests && hashes_ok) ? packed_hash->fd() : out, jobs, err);
+        ::close(packed[0]);
+    });
+
+    int ret = hashes_ok
+        ? filter(unpacked[0], digests ? plain_hash->fd() : packed[1], args, err, stats, std::string(), jobs)
+        : -1;
+    ::close(unpacked[0]);
+    if (digests)
+        hashes_ok &= plain_hash->finish(digests->uncompressed, digests->size);
+    ::close(packed[1]);
+
+    decompressor.join();
+    compressor.join();
+
+    if (digests)
+        hashes_ok &= packed_hash->finish(digests->compressed, digests->size);
+
+    if (!(unpacked_ok && packed_ok && hashes_ok) && stats)
+        stats->complete = false;
+    return (unpacked_ok && packed_ok && hashes_ok) ? ret : -1;
+}
+
+/*static*/ int Tar::run(const Args& args) {
+    Stats stats;
+    int ret = stream(STDIN_FILENO, STDOUT_FILENO, args, std::cerr, &stats);
+
+    std::cerr << "tar: " << stats.members << " members, " << stats.elf << " ELF, "
+              << stats.changed << " patched, " << stats.failed << " failed" << std::endl;
+
+    return ret;
+}
@@ -0,0 +1,182 @@
+#include <safe_patchelf/VersionCheck.h>
+#include <safe_patchelf/Dispatch.h>
+#include <safe_patchelf/Graph.h>
+#include <safe_patchelf/FD.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <algorithm>
+
+namespace {
+
+struct DoVersionNeeds {
+    template<class E>
+    static bool entry(E& elf, size_t size, ElfSummary& summary, std::map<std::string, std::vector<std::string> >& needs) {
+        summary = elf.summary(size);
+        needs   = elf.version_needs(size);
+        return true;
+    }
+};
+
+struct DoVersionDefs {
+    template<class E>
+    static bool entry(E& elf, size_t size, ElfSummary& summary, std::vector<std::string>& defs) {
+        summary = elf.summary(size);
+        defs    = elf.version_defs(size);
+        return true;
+    }
+};
+
+std::string origin_of(const std::string& path) {
+    auto it = path.rfind('/');
+    if (it == std::string::npos)
+        return ".";
+    return it ? path.substr(0, it) : "/";
+}
+
+std::string expand(std::string dir, const std::string& origin, bool is64) {
+    const std::pair<const char*, std::string> vars[] = {
+        {"${ORIGIN}", origin}, {"$ORIGIN", origin},
+        {"${LIB}", is64 ? "lib64" : "lib"}, {"$LIB", is64 ? "lib64" : "lib"},
+    };
+    std::for_each(std::begin(vars), std::end(vars), [&dir](auto& v) {
+        for (auto it = dir.find(v.first); it != std::string::npos; it = dir.find(v.first, it + v.second.size()))
+            dir.replace(it, ::strlen(v.first), v.second);
+    });
+    return dir;
+}
+
+void append_split(std::vector<std::string>& out, const std::string& s) {
+    std::istringstream in(s);
+    std::string dir;
+    while (std::getline(in, dir, ':')) {
+        if (!dir.empty())
+            out.push_back(dir);
+    }
+}
+
+} // namespace
+
+VersionCheck::VersionCheck(std::vector<std::string> library_path)
+    : library_path_(std::move(library_path))
+{
+    DepGraph::load_ld_so_conf("", "/etc/ld.so.conf", conf_dirs_);
+}
+
+std::shared_ptr<const VersionCheck::Defs> VersionCheck::defs(const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = by_path_.find(path);
+        if (it != by_path_.end())
+            return it->second;
+    }
+
+    // Parsed without the lock, a concurrent duplicate parse is harmless
+    std::shared_ptr<Defs> result;
+
+    FD fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    char ident[EI_NIDENT];
+    if (!fd.bad() && ::pread(fd.get(), ident, sizeof(ident), 0) == sizeof(ident) && elf_class(ident).first != None) {
+        size_t size  = fd.size();
+        auto content = reinterpret_cast<caddr_t>(fd.mmap(0, 0, PROT_READ, MAP_FILE | MAP_PRIVATE));
+        if (content && elf_headers_fit(content, size, elf_class(content))) {
+            auto el_class = elf_class(content);
+            ElfSummary summary;
+            std::vector<std::string> versions;
+            if (el_class.first == Elf32)
+                class_entry<Elf32, DoVersionDefs>(content, el_class.second, size, summary, versions);
+            else
+                class_entry<Elf64, DoVersionDefs>(content, el_class.second, size, summary, versions);
+
+            result = std::make_shared<Defs>();
+            result->elf_class = el_class.first;
+            result->machine   = summary.machine;
+            result->versions.insert(versions.begin(), versions.end());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    by_path_.emplace(path, result);
+    return result;
+}
+
+std::vector<std::string> VersionCheck::check(caddr_t content, size_t size, const std::string& path,
+                                             const std::map<std::string, std::string>& renames) {
+    std::vector<std::string> problems;
+
+    auto el_class = elf_class(content);
+    ElfSummary summary;
+    std::map<std::string, std::vector<std::string> > needs;
+    if (el_class.first == Elf32)
+        class_entry<Elf32, DoVersionNeeds>(content, el_class.second, size, summary, needs);
+    else
+        class_entry<Elf64, DoVersionNeeds>(content, el_class.second, size, summary, needs);
+
+    bool is64 = el_class.first == Elf64;
+    auto origin = origin_of(path);
+
+    // ld.so order: DT_RPATH only without DT_RUNPATH, then DT_RUNPATH,
+    // ld.so.conf and default directories. Library path goes first.
+    std::vector<std::string> dirs(library_path_);
+    if (summary.rpath && !summary.runpath)
+        append_split(dirs, *summary.rpath);
+    if (summary.runpath)
+        append_split(dirs, *summary.runpath);
+    dirs.insert(dirs.end(), conf_dirs_.begin(), conf_dirs_.end());
+    if (is64) {
+        dirs.push_back("/lib64");
+        dirs.push_back("/usr/lib64");
+    }
+    dirs.push_back("/lib");
+    dirs.push_back("/usr/lib");
+
+    std::for_each(renames.begin(), renames.end(), [&](auto& rename) {
+        auto it = needs.find(rename.first);
+        bool needed = std::find(summary.needed.begin(), summary.needed.end(), rename.first) != summary.needed.end();
+        if (!needed || it == needs.end() || it->second.empty())
+            return;
+
+        // First candidate of the same class and machine, as ld.so does
+        std::string target;
+        std::shared_ptr<const Defs> found;
+        auto consider = [&](const std::string& candidate) {
+            if (found || ::access(candidate.c_str(), F_OK) != 0)
+                return;
+            auto d = defs(candidate);
+            if (d && d->elf_class == unsigned(el_class.first) && d->machine == summary.machine) {
+                target = candidate;
+                found  = d;
+            }
+        };
+
+        if (rename.second.find('/') != std::string::npos)
+            consider(expand(rename.second, origin, is64));
+        else
+            std::for_each(dirs.begin(), dirs.end(), [&](auto& d) { consider(expand(d, origin, is64) + "/" + rename.second); });
+
+        if (!found) {
+            std::ostringstream msg;
+            msg << "Can't find '" << rename.second << "' to verify versions required from '" << rename.first << "'.";
+            problems.push_back(msg.str());
+            return;
+        }
+
+        std::vector<std::string> missing;
+        std::for_each(it->second.begin(), it->second.end(), [&](auto& version) {
+            if (!found->versions.count(version) && std::find(missing.begin(), missing.end(), version) == missing.end())
+                missing.push_back(version);
+        });
+
+        if (!missing.empty()) {
+            std::ostringstream msg;
+            msg << "'" << target << "' does not provide version(s)";
+            std::for_each(missing.begin(), missing.end(), [&msg](auto& v) { msg << " " << v; });
+            msg << " required from '" << rename.first << "'.";
+            problems.push_back(msg.str());
+        }
+    });
+
+    return problems;
+}
@@ -0,0 +1,119 @@
+#include <safe_patchelf/Walker.h>
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+
+#include <cstring>
+
+/*static*/ std::vector<Walker::Entry> Walker::collect(const std::vector<std::string>& paths, std::ostream& err, bool with_symlinks,
+                                                     bool* failed) {
+    std::vector<Entry> out;
+    bool ok = true;
+
+    std::for_each(paths.begin(), paths.end(), [&](auto& path) {
+        struct ::stat st;
+        if (::stat(path.c_str(), &st) != 0) {
+            err << "error: Can't stat " << path << "!" << std::endl;
+            ok = false;
+            return;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            int dirfd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dirfd < 0) {
+                err << "error: Can't open directory " << path << "!" << std::endl;
+                ok = false;
+                return;
+            }
+            ok &= walk(dirfd, path, out, err, with_symlinks);
+        } else {
+            out.push_back(Entry{path, st, false});
+        }
+    });
+
+    if (failed)
+        *failed = !ok;
+
+    return out;
+}
+
+// Takes ownership of dirfd, false when a directory could not be read
+/*static*/ bool Walker::walk(int dirfd, const std::string& path, std::vector<Entry>& out, std::ostream& err, bool with_symlinks) {
+    DIR* dir = ::fdopendir(dirfd);
+    if (!dir) {
+        ::close(dirfd);
+        err << "error: Can't read directory " << path << "!" << std::endl;
+        return false;
+    }
+
+    bool ok = true;
+
+    std::vector<std::string> subdirs;
+
+    while (auto de = ::readdir(dir)) {
+        if (::strcmp(de->d_name, ".") == 0 || ::strcmp(de->d_name, "..") == 0)
+            continue;
+
+        if (de->d_type == DT_LNK && !with_symlinks)
+            continue;
+
+        if (de->d_type == DT_DIR) {
+            subdirs.push_back(de->d_name);
+            continue;
+        }
+
+        if (de->d_type != DT_REG && de->d_type != DT_LNK && de->d_type != DT_UNKNOWN)
+            continue;
+
+        struct ::stat st;
+        if (::fstatat(dirfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            continue;
+
+        std::string entry_path = path + "/" + de->d_name;
+        if (S_ISDIR(st.st_mode))
+            subdirs.push_back(de->d_name);
+        else if (S_ISREG(st.st_mode) || (S_ISLNK(st.st_mode) && with_symlinks))
+            out.push_back(Entry{std::move(entry_path), st, true});
+    }
+
+    std::sort(subdirs.begin(), subdirs.end());
+    std::for_each(subdirs.begin(), subdirs.end(), [&](auto& name) {
+        int subfd = ::openat(dirfd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (subfd < 0) {
+            err << "error: Can't open directory " << path << "/" << name << "!" << std::endl;
+            ok = false;
+            return;
+        }
+        ok &= walk(subfd, path + "/" + name, out, err, with_symlinks);
+    });
+
+    ::closedir(dir);
+
+    return ok;
+}
+
+/*static*/ std::vector<Walker::Group> Walker::group_by_inode(const std::vector<Entry>& entries) {
+    std::vector<Group> groups;
+    groups.reserve(entries.size());
+
+    std::map<std::pair<dev_t, ino_t>, size_t> by_inode;
+
+    std::for_each(entries.begin(), entries.end(), [&](auto& entry) {
+        auto ret = by_inode.insert(std::make_pair(std::make_pair(entry.st.st_dev, entry.st.st_ino), groups.size()));
+        if (ret.second) {
+            groups.push_back(Group{&entry});
+            return;
+        }
+
+        auto& group = groups[ret.first->second];
+        bool dup = std::any_of(group.begin(), group.end(), [&](auto* e) { return e->path == entry.path; });
+        if (!dup)
+            group.push_back(&entry);
+    });
+
+    return groups;
+}
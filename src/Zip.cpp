@@ -0,0 +1,779 @@
+#include <safe_patchelf/Zip.h>
+#include <safe_patchelf/Batch.h>
+#include <safe_patchelf/Dispatch.h>
+#include <safe_patchelf/Scheduler.h>
+#include <safe_patchelf/FD.h>
+#include <safe_patchelf/Hash.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <sstream>
+#include <new>
+#include <optional>
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+
+enum : uint32_t {
+    LOCAL_SIG       = 0x04034b50,
+    CENTRAL_SIG     = 0x02014b50,
+    END_SIG         = 0x06054b50,
+    DESCRIPTOR_SIG  = 0x08074b50,
+};
+
+enum : size_t {
+    LOCAL_SIZE      = 30,
+    CENTRAL_SIZE    = 46,
+    END_SIZE        = 22,
+    MAX_COMMENT     = 0xffff,
+};
+
+enum : uint16_t {
+    STORED          = 0,
+    DEFLATED        = 8,
+};
+
+enum : uint16_t {
+    ENCRYPTED       = 1,
+    HAS_DESCRIPTOR  = 8,
+};
+
+const size_t COPY_SIZE = 1 << 20;
+
+// Deflate can't compress better than 1032:1
+const uint64_t MAX_RATIO = 1032;
+
+uint16_t get16(const char* p) {
+    return uint16_t(uint8_t(p[0]) | uint8_t(p[1]) << 8);
+}
+
+uint32_t get32(const char* p) {
+    return uint32_t(get16(p)) | uint32_t(get16(p + 2)) << 16;
+}
+
+void put16(char* p, uint16_t v) {
+    p[0] = char(v);
+    p[1] = char(v >> 8);
+}
+
+void put32(char* p, uint32_t v) {
+    put16(p, uint16_t(v));
+    put16(p + 2, uint16_t(v >> 16));
+}
+
+struct Entry {
+    std::string name;
+    size_t central;             // central directory record and its size
+    size_t central_size;
+    uint16_t flags;
+    uint16_t method;
+    uint32_t crc;
+    uint64_t csize;
+    uint64_t usize;
+    uint64_t local;             // local header, compressed data, end of
+    uint64_t data;              // the entry including the data descriptor
+    uint64_t end;
+
+    // Patch result
+    int ret = 0;
+    bool changed = false;
+    uint32_t new_crc = 0;
+    uint64_t new_usize = 0;
+    std::vector<std::pair<size_t, std::string> > edits;    // in place, same size stored entries
+    std::optional<std::string> replaced;                    // new data compressed with method
+    std::string record;                                     // wheel RECORD hash and size fields
+    std::string messages;
+};
+
+struct Directory {
+    std::vector<Entry> entries; // central directory order
+    size_t cd_offset;
+    size_t end;                 // end of central directory record
+};
+
+std::optional<Directory> read_directory(const char* content, size_t size, std::string& error) {
+    if (size < END_SIZE) {
+        error = "Not a ZIP archive";
+        return std::nullopt;
+    }
+
+    // The end record is followed only by its comment
+    size_t end = size - END_SIZE;
+    size_t last = (size - END_SIZE > MAX_COMMENT) ? size - END_SIZE - MAX_COMMENT : 0;
+    while (!(get32(content + end) == END_SIG && get16(content + end + 20) <= size - end - END_SIZE)) {
+        if (end == last) {
+            error = "Not a ZIP archive";
+            return std::nullopt;
+        }
+        --end;
+    }
+
+    const char* eocd = content + end;
+    if (get16(eocd + 4) != 0 || get16(eocd + 6) != 0 || get16(eocd + 8) != get16(eocd + 10)) {
+        error = "Multi disk ZIP archives are not supported";
+        return std::nullopt;
+    }
+
+    size_t count     = get16(eocd + 10);
+    size_t cd_size   = get32(eocd + 12);
+    size_t cd_offset = get32(eocd + 16);
+    if (count == 0xffff || cd_size == 0xffffffff || cd_offset == 0xffffffff) {
+        error = "ZIP64 archives are not supported";
+        return std::nullopt;
+    }
+    if (cd_offset > end || cd_size > end - cd_offset) {
+        error = "Broken central directory";
+        return std::nullopt;
+    }
+
+    Directory dir;
+    dir.cd_offset = cd_offset;
+    dir.end = end;
+    dir.entries.reserve(count);
+
+    size_t pos = cd_offset;
+    for (size_t i = 0; i < count; ++i) {
+        const char* rec = content + pos;
+        if (cd_offset + cd_size - pos < CENTRAL_SIZE || get32(rec) != CENTRAL_SIG) {
+            error = "Broken central directory";
+            return std::nullopt;
+        }
+
+        Entry e;
+        e.central      = pos;
+        e.central_size = CENTRAL_SIZE + get16(rec + 28) + get16(rec + 30) + get16(rec + 32);
+        e.flags        = get16(rec + 8);
+        e.method       = get16(rec + 10);
+        e.crc          = get32(rec + 16);
+        e.csize        = get32(rec + 20);
+        e.usize        = get32(rec + 24);
+        e.local        = get32(rec + 42);
+
+        if (e.central_size > cd_offset + cd_size - pos) {
+            error = "Broken central directory";
+            return std::nullopt;
+        }
+        e.name.assign(rec + CENTRAL_SIZE, get16(rec + 28));
+
+        if (e.csize == 0xffffffff || e.usize == 0xffffffff || e.local == 0xffffffff) {
+            error = "ZIP64 archives are not supported";
+            return std::nullopt;
+        }
+
+        const char* local = content + e.local;
+        if (e.local > cd_offset || cd_offset - e.local < LOCAL_SIZE || get32(local) != LOCAL_SIG) {
+            error = "Broken local header of " + e.name;
+            return std::nullopt;
+        }
+
+        e.data = e.local + LOCAL_SIZE + get16(local + 26) + get16(local + 28);
+        if (e.data > cd_offset || e.csize > cd_offset - e.data) {
+            error = "Broken local header of " + e.name;
+            return std::nullopt;
+        }
+
+        dir.entries.push_back(std::move(e));
+        pos += dir.entries.back().central_size;
+    }
+
+    // Each entry reaches up to the next one, that covers data descriptors
+    std::vector<Entry*> by_offset;
+    std::for_each(dir.entries.begin(), dir.entries.end(), [&](auto& e) { by_offset.push_back(&e); });
+    std::sort(by_offset.begin(), by_offset.end(), [](auto* a, auto* b) { return a->local < b->local; });
+    for (size_t i = 0; i < by_offset.size(); ++i) {
+        by_offset[i]->end = (i + 1 < by_offset.size()) ? by_offset[i + 1]->local : cd_offset;
+        if (by_offset[i]->end < by_offset[i]->data + by_offset[i]->csize) {
+            error = "Overlapping entries " + by_offset[i]->name;
+            return std::nullopt;
+        }
+    }
+
+    return dir;
+}
+
+// Raw deflate stream into exactly out_size bytes, or into the first
+// out_size bytes only when partial
+bool inflate_raw(const char* in, size_t in_size, char* out, size_t out_size, bool partial) {
+    z_stream zs{};
+    if (::inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+        return false;
+
+    zs.next_in   = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+    zs.avail_in  = uInt(in_size);
+    zs.next_out  = reinterpret_cast<Bytef*>(out);
+    zs.avail_out = uInt(out_size);
+
+    int rc = ::inflate(&zs, partial ? Z_SYNC_FLUSH : Z_FINISH);
+    bool ok = partial
+        ? (rc == Z_OK || rc == Z_STREAM_END || rc == Z_BUF_ERROR) && zs.total_out == out_size
+        : rc == Z_STREAM_END && zs.total_out == out_size;
+
+    ::inflateEnd(&zs);
+    return ok;
+}
+
+std::optional<std::string> deflate_raw(const char* in, size_t size) {
+    z_stream zs{};
+    if (::deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return std::nullopt;
+
+    std::string out(::deflateBound(&zs, uLong(size)), '\0');
+    zs.next_in   = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+    zs.avail_in  = uInt(size);
+    zs.next_out  = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = uInt(out.size());
+
+    int rc = ::deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    ::deflateEnd(&zs);
+
+    if (rc != Z_STREAM_END || out.size() >= 0xffffffff)
+        return std::nullopt;
+    return out;
+}
+
+// "sha256=<urlsafe base64 without padding>,<size>" as in wheel RECORD files
+std::string record_fields(const std::string& bytes) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+    Sha256 sha;
+    sha.update(bytes.data(), bytes.size());
+    uint8_t digest[Sha256::DIGEST_SIZE];
+    sha.digest(digest);
+
+    std::string fields = "sha256=";
+    for (size_t i = 0; i < sizeof(digest); i += 3) {
+        uint32_t v = uint32_t(digest[i]) << 16;
+        size_t n = std::min<size_t>(3, sizeof(digest) - i);
+        if (n > 1)
+            v |= uint32_t(digest[i + 1]) << 8;
+        if (n > 2)
+            v |= digest[i + 2];
+        for (size_t j = 0; j <= n; ++j)
+            fields += alphabet[(v >> (18 - 6 * j)) & 0x3f];
+    }
+
+    return fields + "," + std::to_string(bytes.size());
+}
+
+// The uncompressed size is allocated up front, it must be one the
+// compressed data can actually hold
+bool plausible(const Entry& e) {
+    return e.method == STORED ? e.csize == e.usize : e.usize / MAX_RATIO <= e.csize;
+}
+
+// Uncompressed data of a stored or deflated entry
+std::optional<std::string> read_entry(const char* content, const Entry& e) {
+    if (e.flags & ENCRYPTED || !plausible(e))
+        return std::nullopt;
+
+    std::string bytes;
+    try {
+        bytes.resize(e.usize);
+    } catch (const std::bad_alloc&) {
+        return std::nullopt;
+    }
+
+    if (e.method == STORED && e.csize == e.usize)
+        ::memcpy(&bytes[0], content + e.data, e.usize);
+    else if (e.method != DEFLATED || !inflate_raw(content + e.data, e.csize, &bytes[0], bytes.size(), false))
+        return std::nullopt;
+
+    if (::crc32(0, reinterpret_cast<const Bytef*>(bytes.data()), uInt(bytes.size())) != e.crc)
+        return std::nullopt;
+    return bytes;
+}
+
+// Top level <name>-<version>.dist-info/RECORD of a wheel
+bool is_record(const std::string& name) {
+    static const std::string suffix = ".dist-info/RECORD";
+    return name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0
+        && name.find('/') == name.size() - 7;
+}
+
+// Signature files of signed JARs and wheels
+bool is_signature(const std::string& name) {
+    auto ends_with = [&](const std::string& suffix) {
+        return name.size() > suffix.size()
+            && std::equal(suffix.rbegin(), suffix.rend(), name.rbegin(), [](char a, char b) { return a == ::toupper(b); });
+    };
+
+    if (name.compare(0, 9, "META-INF/") == 0 && name.find('/', 9) == std::string::npos)
+        return ends_with(".SF") || ends_with(".RSA") || ends_with(".DSA") || ends_with(".EC");
+    return ends_with(".DIST-INFO/RECORD.JWS") || ends_with(".DIST-INFO/RECORD.P7S");
+}
+
+// RECORD lines of changed entries get their new hash and size. The path
+// is everything before the last two fields, CSV quoted when needed.
+std::string update_record(const std::string& record, const std::unordered_map<std::string, const Entry*>& changed) {
+    std::string out;
+    size_t pos = 0;
+    while (pos < record.size()) {
+        size_t eol = record.find('\n', pos);
+        eol = (eol == std::string::npos) ? record.size() : eol + 1;
+        std::string line = record.substr(pos, eol - pos);
+        pos = eol;
+
+        size_t body = line.size();
+        while (body && (line[body - 1] == '\n' || line[body - 1] == '\r'))
+            --body;
+
+        size_t size_field = line.rfind(',', body ? body - 1 : 0);
+        size_t hash_field = (size_field == std::string::npos || size_field == 0)
+            ? std::string::npos : line.rfind(',', size_field - 1);
+        if (hash_field == std::string::npos) {
+            out += line;
+            continue;
+        }
+
+        std::string name = line.substr(0, hash_field);
+        if (name.size() >= 2 && name.front() == '"' && name.back() == '"') {
+            std::string unquoted;
+            for (size_t i = 1; i + 1 < name.size(); ++i) {
+                unquoted += name[i];
+                if (name[i] == '"' && name[i + 1] == '"')
+                    ++i;
+            }
+            name = unquoted;
+        }
+
+        auto it = changed.find(name);
+        if (it == changed.end()) {
+            out += line;
+            continue;
+        }
+        out += line.substr(0, hash_field + 1) + it->second->record + line.substr(body);
+    }
+    return out;
+}
+
+// New RECORD content for the changed entries, either as same size in
+// place edits or as replaced data
+bool patch_record(const char* content, Entry& record, const std::vector<Entry>& entries) {
+    std::unordered_map<std::string, const Entry*> changed;
+    std::for_each(entries.begin(), entries.end(), [&](auto& e) {
+        if (e.changed)
+            changed.emplace(e.name, &e);
+    });
+
+    auto bytes = read_entry(content, record);
+    if (!bytes)
+        return false;
+
+    std::string updated = update_record(*bytes, changed);
+    if (updated == *bytes)
+        return true;
+
+    record.new_crc = uint32_t(::crc32(0, reinterpret_cast<const Bytef*>(updated.data()), uInt(updated.size())));
+    record.new_usize = updated.size();
+
+    if (record.method == STORED && updated.size() == bytes->size())
+        record.edits.emplace_back(0, updated);
+    else if (record.method == STORED)
+        record.replaced = updated;
+    else if (!(record.replaced = deflate_raw(updated.data(), updated.size())))
+        return false;
+
+    record.changed = true;
+    return true;
+}
+
+void patch_elf(const char* content, Entry& e, const Args& args, const std::string& prefix, Zip::Stats& stats);
+
+void patch_entry(const char* content, Entry& e, const Args& args, const std::string& path, Zip::Stats& stats) {
+    if (e.flags & ENCRYPTED || e.usize < EI_NIDENT || (e.method != STORED && e.method != DEFLATED))
+        return;
+    if (e.method == STORED && e.csize != e.usize)
+        return;
+
+    const char* data = content + e.data;
+
+    char ident[EI_NIDENT];
+    if (e.method == STORED)
+        ::memcpy(ident, data, sizeof(ident));
+    else if (!inflate_raw(data, e.csize, ident, sizeof(ident), true))
+        return;
+    if (elf_class(ident).first == None)
+        return;
+
+    ++stats.elf;
+
+    std::string prefix = path + "!" + e.name + ": ";
+    const char* error = !plausible(e) ? "Bad entry size!" : nullptr;
+    if (!error) {
+        try {
+            patch_elf(content, e, args, prefix, stats);
+        } catch (const std::bad_alloc&) {
+            error = "Not enough memory to patch!";
+        }
+    }
+
+    if (error) {
+        e.messages += prefix + "error: " + error + "\n";
+        e.ret = -1;
+        e.changed = false;
+        e.edits.clear();
+        e.replaced.reset();
+        ++stats.failed;
+    }
+}
+
+// Inflated ELF entry patched in memory, the result kept in e
+void patch_elf(const char* content, Entry& e, const Args& args, const std::string& prefix, Zip::Stats& stats) {
+    const char* data = content + e.data;
+    std::ostringstream messages;
+
+    std::string bytes(e.usize, '\0');
+    if (e.method == STORED) {
+        ::memcpy(&bytes[0], data, e.usize);
+    } else if (!inflate_raw(data, e.csize, &bytes[0], bytes.size(), false)
+               || ::crc32(0, reinterpret_cast<const Bytef*>(bytes.data()), uInt(bytes.size())) != e.crc) {
+        messages << prefix << "error: Can't inflate!" << std::endl;
+        e.messages = messages.str();
+        e.ret = -1;
+        ++stats.failed;
+        return;
+    }
+
+    std::string original(bytes);
+    Batch::Ranges ranges;
+    e.ret = Batch::patch_buffer(&bytes[0], bytes.size(), args, prefix, messages, messages, &e.changed, &ranges);
+    e.messages = messages.str();
+    if (e.ret != 0) {
+        e.changed = false;
+        ++stats.failed;
+        return;
+    }
+    if (!e.changed)
+        return;
+
+    e.new_crc = e.crc;
+    std::for_each(ranges.begin(), ranges.end(), [&](auto& r) {
+        e.new_crc = Zip::crc32_update(e.new_crc, bytes.size(), r.first, original.data() + r.first, bytes.data() + r.first, r.second);
+    });
+
+    e.new_usize = e.usize;
+    e.record = record_fields(bytes);
+
+    if (e.method == STORED) {
+        std::for_each(ranges.begin(), ranges.end(), [&](auto& r) {
+            e.edits.emplace_back(r.first, bytes.substr(r.first, r.second));
+        });
+    } else {
+        e.replaced = deflate_raw(bytes.data(), bytes.size());
+        if (!e.replaced) {
+            e.messages += prefix + "error: Can't deflate!\n";
+            e.changed = false;
+            e.ret = -1;
+            ++stats.failed;
+            return;
+        }
+    }
+
+    ++stats.changed;
+}
+
+bool pwrite_full(int fd, const void* buf, size_t len, size_t offset) {
+    auto p = reinterpret_cast<const char*>(buf);
+    while (len) {
+        ssize_t n = ::pwrite(fd, p, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Edits and CRC of a stored entry whose local header now is at local
+bool write_in_place(int fd, const char* content, const Entry& e, size_t local) {
+    size_t data = local + (e.data - e.local);
+
+    bool ok = std::all_of(e.edits.begin(), e.edits.end(), [&](auto& edit) {
+        return pwrite_full(fd, edit.second.data(), edit.second.size(), data + edit.first);
+    });
+
+    char crc[4];
+    put32(crc, e.new_crc);
+
+    // With a data descriptor the local header CRC usually is zero
+    if (!(e.flags & HAS_DESCRIPTOR) || get32(content + e.local + 14) != 0)
+        ok = ok && pwrite_full(fd, crc, sizeof(crc), local + 14);
+
+    if (e.flags & HAS_DESCRIPTOR) {
+        size_t descriptor = e.data + e.csize;
+        if (e.end - descriptor >= 4 && get32(content + descriptor) == DESCRIPTOR_SIG)
+            descriptor += 4;
+        if (e.end - descriptor >= 4)
+            ok = ok && pwrite_full(fd, crc, sizeof(crc), local + (descriptor - e.local));
+    }
+
+    return ok;
+}
+
+// Sequential output of the rewritten archive
+class Output {
+public:
+    Output(int in, const char* content, int out)
+        : in_(in)
+        , content_(content)
+        , out_(out)
+    {
+    }
+
+    bool write(const void* buf, size_t len) {
+        if (!pwrite_full(out_, buf, len, offset_))
+            return false;
+        offset_ += len;
+        return true;
+    }
+
+    // Verbatim bytes of the input, in kernel when possible
+    bool copy(size_t from, size_t len) {
+        while (len) {
+            loff_t in_off  = from;
+            loff_t out_off = offset_;
+            ssize_t n = copy_ ? ::copy_file_range(in_, &in_off, out_, &out_off, std::min(len, COPY_SIZE), 0) : -1;
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                copy_ = false;
+                n = std::min(len, COPY_SIZE);
+                if (!pwrite_full(out_, content_ + from, n, offset_))
+                    return false;
+            }
+            from += n;
+            len -= n;
+            offset_ += n;
+        }
+        return true;
+    }
+
+    size_t offset() const { return offset_; }
+
+private:
+    int in_;
+    const char* content_;
+    int out_;
+    size_t offset_ = 0;
+    bool copy_ = true;
+};
+
+bool rewrite(int in, const char* content, const Directory& dir, int out) {
+    Output output(in, content, out);
+
+    std::vector<const Entry*> by_offset;
+    std::for_each(dir.entries.begin(), dir.entries.end(), [&](auto& e) { by_offset.push_back(&e); });
+    std::sort(by_offset.begin(), by_offset.end(), [](auto* a, auto* b) { return a->local < b->local; });
+
+    // Self extracting stubs and the like
+    if (!output.copy(0, by_offset.empty() ? dir.cd_offset : by_offset.front()->local))
+        return false;
+
+    std::vector<size_t> locals(dir.entries.size());
+    for (auto* e : by_offset) {
+        size_t local = output.offset();
+        locals[e - dir.entries.data()] = local;
+
+        if (!e->replaced) {
+            if (!output.copy(e->local, e->end - e->local))
+                return false;
+            if (e->changed && !write_in_place(out, content, *e, local))
+                return false;
+            continue;
+        }
+
+        // Sizes are known now, no data descriptor
+        std::string header(content + e->local, e->data - e->local);
+        put16(&header[6], e->flags & ~HAS_DESCRIPTOR);
+        put32(&header[14], e->new_crc);
+        put32(&header[18], uint32_t(e->replaced->size()));
+        put32(&header[22], uint32_t(e->new_usize));
+
+        if (!output.write(header.data(), header.size()) || !output.write(e->replaced->data(), e->replaced->size()))
+            return false;
+    }
+
+    size_t cd_offset = output.offset();
+    for (size_t i = 0; i < dir.entries.size(); ++i) {
+        auto& e = dir.entries[i];
+        std::string rec(content + e.central, e.central_size);
+        if (e.changed)
+            put32(&rec[16], e.new_crc);
+        if (e.replaced) {
+            put16(&rec[8], e.flags & ~HAS_DESCRIPTOR);
+            put32(&rec[20], uint32_t(e.replaced->size()));
+            put32(&rec[24], uint32_t(e.new_usize));
+        }
+        put32(&rec[42], uint32_t(locals[i]));
+        if (!output.write(rec.data(), rec.size()))
+            return false;
+    }
+
+    size_t cd_size = output.offset() - cd_offset;
+    if (cd_offset >= 0xffffffff || cd_size >= 0xffffffff)
+        return false;
+
+    std::string eocd(content + dir.end, END_SIZE + get16(content + dir.end + 20));
+    put32(&eocd[12], uint32_t(cd_size));
+    put32(&eocd[16], uint32_t(cd_offset));
+
+    return output.write(eocd.data(), eocd.size());
+}
+
+} // namespace
+
+/*static*/ uint32_t Zip::crc32_update(uint32_t crc, uint64_t size, uint64_t offset,
+                                      const char* old_bytes, const char* new_bytes, size_t len) {
+    // CRC-32 is affine in the content: the CRCs of two contents of equal
+    // size differ by the linear part of the CRC of their xor. That is the
+    // CRC of the changed bytes without its constant, moved over the
+    // unchanged tail by a combine operator.
+    std::vector<Bytef> delta(len);
+    for (size_t i = 0; i < len; ++i)
+        delta[i] = Bytef(old_bytes[i] ^ new_bytes[i]);
+
+    uLong linear = ::crc32(0, delta.data(), uInt(len));
+    std::fill(delta.begin(), delta.end(), 0);
+    linear ^= ::crc32(0, delta.data(), uInt(len));
+
+    uLong shifted = ::crc32_combine_op(linear, 0, ::crc32_combine_gen(z_off_t(size - offset - len)));
+
+    return uint32_t(crc ^ shifted);
+}
+
+/*static*/ int Zip::patch(const std::string& path, const Args& args, std::ostream& out, std::ostream& err, Stats* stats) {
+    FD fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.bad()) {
+        err << "error: Can't open " << path << "!" << std::endl;
+        return -1;
+    }
+
+    auto st = fd.stat();
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+        err << "error: " << path << ": Not a ZIP archive!" << std::endl;
+        return -1;
+    }
+
+    auto content = reinterpret_cast<const char*>(fd.mmap(0, 0, PROT_READ, MAP_FILE | MAP_PRIVATE));
+    if (!content) {
+        err << "error: Can't map " << path << "!" << std::endl;
+        return -1;
+    }
+
+    std::string error;
+    auto dir = read_directory(content, st.st_size, error);
+    if (!dir) {
+        err << "error: " << path << ": " << error << "!" << std::endl;
+        return -1;
+    }
+
+    unsigned jobs = args.jobs ? args.jobs : Scheduler::default_jobs();
+    std::vector<Stats> entry_stats(dir->entries.size());
+    Scheduler::run(dir->entries.size(), jobs, [&](size_t i) {
+        patch_entry(content, dir->entries[i], args, path, entry_stats[i]);
+    });
+
+    Stats total;
+    total.entries = dir->entries.size();
+    int ret = 0;
+    for (size_t i = 0; i < dir->entries.size(); ++i) {
+        auto& e = dir->entries[i];
+        (e.ret != 0 ? err : out) << e.messages;
+        if (e.ret != 0)
+            ret = -1;
+        total.elf     += entry_stats[i].elf;
+        total.changed += entry_stats[i].changed;
+        total.failed  += entry_stats[i].failed;
+    }
+    if (stats)
+        *stats = total;
+
+    if (total.changed == 0)
+        return ret;
+
+    // Wheels list hashes and sizes of their files, signatures of signed
+    // JARs and wheels no longer match and can't be redone here
+    auto& entries = dir->entries;
+    auto record = std::find_if(entries.begin(), entries.end(), [](auto& e) { return is_record(e.name); });
+    if (record != entries.end() && !patch_record(content, *record, entries)) {
+        err << "error: " << path << ": Can't update " << record->name << "!" << std::endl;
+        return -1;
+    }
+    if (std::any_of(entries.begin(), entries.end(), [](auto& e) { return is_signature(e.name); }))
+        err << "warning: " << path << ": Signed archive, signatures of patched entries are invalid now!" << std::endl;
+
+    bool resized = std::any_of(entries.begin(), entries.end(), [](auto& e) { return bool(e.replaced); });
+
+    // Only stored entries changed: same sizes, edit the archive in place
+    if (!resized) {
+        FD rw(::open(path.c_str(), O_RDWR | O_CLOEXEC));
+        if (rw.bad() || rw.size() != size_t(st.st_size)) {
+            err << "error: Can't open " << path << " for writing!" << std::endl;
+            return -1;
+        }
+
+        bool ok = std::all_of(dir->entries.begin(), dir->entries.end(), [&](auto& e) {
+            if (!e.changed)
+                return true;
+            char crc[4];
+            put32(crc, e.new_crc);
+            return write_in_place(rw.get(), content, e, e.local) && pwrite_full(rw.get(), crc, sizeof(crc), e.central + 16);
+        });
+        if (!ok) {
+            err << "error: Can't write " << path << "!" << std::endl;
+            return -1;
+        }
+        return ret;
+    }
+
+    // Write aside next to it and rename, readers never see a partial
+    // archive. A unique name never clobbers an unrelated file.
+    std::string tmp;
+    {
+        FD tmp_fd = FD::temp_beside(path, tmp);
+        if (tmp_fd.bad()) {
+            err << "error: Can't create " << tmp << "!" << std::endl;
+            return -1;
+        }
+        if (!rewrite(fd.get(), content, *dir, tmp_fd.get())) {
+            err << "error: Can't write " << tmp << "!" << std::endl;
+            ::unlink(tmp.c_str());
+            return -1;
+        }
+    }
+
+    if (::rename(tmp.c_str(), path.c_str()) != 0) {
+        err << "error: Can't rename " << tmp << " to " << path << "!" << std::endl;
+        ::unlink(tmp.c_str());
+        return -1;
+    }
+
+    return ret;
+}
+
+/*static*/ int Zip::run(const Args& args) {
+    int ret = 0;
+
+    std::for_each(args.filenames.begin(), args.filenames.end(), [&](auto& path) {
+        Stats stats;
+        if (patch(path, args, std::cout, std::cerr, &stats) != 0)
+            ret = -1;
+
+        std::cout << "zip: " << path << ": " << stats.entries << " entries, " << stats.elf << " ELF, "
+                  << stats.changed << " patched, " << stats.failed << " failed" << std::endl;
+    });
+
+    return ret;
+}
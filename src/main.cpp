@@ -1,115 +1,73 @@
 #include <iostream>
 
-#include <fcntl.h>
-
-#include <safe_patchelf/commons.h>
-#include <safe_patchelf/FD.h>
-#include <safe_patchelf/Elf.h>
 #include <safe_patchelf/Args.h>
+#include <safe_patchelf/Batch.h>
+#include <safe_patchelf/Query.h>
+#include <safe_patchelf/Graph.h>
+#include <safe_patchelf/NeededIndex.h>
+#include <safe_patchelf/Tar.h>
+#include <safe_patchelf/Zip.h>
+#include <safe_patchelf/Cpio.h>
+#include <safe_patchelf/Oci.h>
+#include <safe_patchelf/Firmware.h>
+#include <safe_patchelf/Pipe.h>
 
 
-struct DoElfPatching {
-    template<class E>
-    static bool entry(E& elf, const Args& args) {
-        bool success = true;
-
-        if (!args.soname.empty())
-            success &= elf.set_soname(args.soname.c_str());
-
-        if (!args.neededs.empty())
-            success &= elf.update_neededs(args.neededs);
-
-        if (!elf.results().empty()) {
-            std::for_each(elf.results().begin(), elf.results().end(), [](auto& it) {
-                if (it.first)
-                    std::cerr << it.second << std::endl;
-                else
-                    std::cout << it.second << std::endl;
-            });
-        }
-
-        return success;
-    }
-};
-
-
-template<ElfClass Class, class Worker>
-int class_entry(void* content, Endian elf_endian, const Args& args) {
-    bool success = false;
-
-    if (elf_endian == Little) {
-        using LElf = Elf<Class, Little>;
-        LElf elf(content);
-        success = Worker::entry(elf, args);
-    } else if (elf_endian == Big) {
-        using BElf = Elf<Class, Big>;
-        BElf elf(content);
-        success = Worker::entry(elf, args);
-    }
+int main(int argc, char** argv) {
 
-    if (!success) {
+    auto args = Args::parse_args(argc, argv);
+    if (!args) {
         return -1;
-    } else {
-        return 0;
     }
-}
-
-
-std::pair<ElfClass, Endian> elf_class(caddr_t contents) {
-    if (::memcmp(contents, ELFMAG, SELFMAG) != 0)
-        return std::make_pair(None, Unknown);
-
-    if (contents[EI_VERSION] != EV_CURRENT)
-        return std::make_pair(None, Unknown);
 
-    Endian elf_endian = contents[EI_DATA] == ELFDATA2LSB ? Little : Big;
+    if (args->query)
+        return Query::run(*args);
 
-    if (contents[EI_CLASS] == ELFCLASS32)
-        return std::make_pair(Elf32, elf_endian);
+    if (args->graph)
+        return DepGraph::run(*args);
 
-    if (contents[EI_CLASS] == ELFCLASS64)
-        return std::make_pair(Elf64, elf_endian);
+    if (!args->index.empty() && (!args->who_needs.empty() || args->fingerprint() == 0))
+        return NeededIndex::run(*args);
 
-    return std::make_pair(None, Unknown);
-}
-
-
-int main(int argc, char** argv) {
+    // Standard output carries the archive or the file
+    if (args->tar) {
+        if (!args->have_work()) {
+            std::cerr << "error: Nothing to do!" << std::endl;
+            return -1;
+        }
+        return Tar::run(*args);
+    }
 
-    auto args = Args::parse_args(argc, argv);
-    if (!args) {
-        return -1;
+    if (args->stdio()) {
+        if (!args->have_work()) {
+            std::cerr << "error: Nothing to do!" << std::endl;
+            return -1;
+        }
+        return Pipe::run(*args);
     }
 
-    args->print();
+    // Standard output is NDJSON with --digest
+    args->print(args->digest ? std::cerr : std::cout);
 
     if (!args->have_work()) {
         std::cerr << "error: Nothing to do!" << std::endl;
         return -1;
     }
 
-    FD fd(::open(args->filename.c_str(), O_RDWR));
-    if (fd.bad()) {
-        std::cerr << "error: Can't open " << args->filename << "!" << std::endl;
-        return -1;
-    }
+    if (args->zip)
+        return Zip::run(*args);
 
-    caddr_t content = reinterpret_cast<caddr_t>(fd.mmap(0, 0, PROT_READ|PROT_WRITE));
+    if (args->cpio)
+        return Cpio::run(*args);
 
-    auto el_class = elf_class(content);
-    switch(el_class.first) {
-    case Elf32:
-    {
-        return class_entry<Elf32, DoElfPatching>(content, el_class.second, *args);
-    }
-    break;
-    case Elf64:
-    {
-        return class_entry<Elf64, DoElfPatching>(content, el_class.second, *args);
-    }
-    break;
-    default:
-        std::cerr << "error: " << args->filename << " not an ELF file!" << std::endl;
-        return -1;
-    };
+    if (args->oci)
+        return Oci::run(*args);
+
+    if (args->blob)
+        return Firmware::run(*args);
+
+    if (!args->index.empty())
+        return NeededIndex::patch(*args);
+
+    return Batch::run(*args);
 }